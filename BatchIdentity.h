@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef BATCHIDENTITY_H_
+#define BATCHIDENTITY_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "TSUtil.h"
+
+// an identity that is computed together with others by the batch kernel,
+// the devices share their time between the identities according to their weights
+struct BatchIdentity {
+  std::string nickname;
+  std::string identity;
+  uint64_t weight;
+
+  // the first counter that has not been scheduled
+  volatile uint64_t startcounter;
+  // the first counters of the ranges that are being hashed, all counters
+  // before them and before startcounter have been hashed
+  std::multiset<uint64_t> inflight;
+  volatile uint8_t bestdifficulty;
+  volatile uint64_t bestdifficulty_counter;
+
+  // the counters scheduled so far, an identity whose share of them is below
+  // its share of the weights is scheduled next (see TSHasherContext::run_batch_loop)
+  uint64_t scheduledcounters;
+
+  BatchIdentity(std::string nickname, std::string identity, uint64_t weight,
+    uint64_t startcounter, uint64_t bestcounter) :
+    nickname(std::move(nickname)), identity(std::move(identity)), weight(weight),
+    startcounter(startcounter),
+    bestdifficulty(TSUtil::getDifficulty(this->identity, bestcounter)),
+    bestdifficulty_counter(bestcounter),
+    scheduledcounters(0) {}
+
+  // the first counter that may not have been hashed yet
+  uint64_t getFirstUnfinished() const {
+    return inflight.empty() ? (uint64_t)startcounter : std::min((uint64_t)startcounter, *inflight.begin());
+  }
+};
+
+#endif
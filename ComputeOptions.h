@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef COMPUTEOPTIONS_H_
+#define COMPUTEOPTIONS_H_
+
+// how the counters of a kernel launch are distributed to the lanes
+enum CounterLayout {
+  // every lane hashes a contiguous range of counters
+  LAYOUT_CONTIGUOUS,
+  // in every iteration, neighbouring lanes hash neighbouring counters,
+  // such that they share their high digits and carry in lockstep
+  LAYOUT_INTERLEAVED
+};
+
+// which kinds of OpenCL devices are used
+enum DeviceSelection {
+  DEVICES_GPU,
+  DEVICES_CPU,
+  DEVICES_ALL
+};
+
+// the options of the compute command
+struct ComputeOptions {
+  CounterLayout layout;
+  // whether the kernels keep running and pull counter ranges from a device-side
+  // work queue instead of being launched once per range
+  bool persistent;
+  DeviceSelection devices;
+  // whether the native CPU engine runs besides the OpenCL devices,
+  // with the given number of threads or one per free core if it is 0
+  bool native;
+  unsigned nativethreads;
+  // whether several identities are computed at once by the batch kernel
+  bool batch;
+  // whether the kernels count the difficulties of all their hashes,
+  // which checks the reported speed independently
+  bool histogram;
+  // whether the kernels write a checksum of their digests, which the host
+  // recomputes for sampled work items to prove that they have hashed all their counters
+  bool audit;
+  // the duration in milliseconds every kernel launch should take,
+  // to which the iterations per launch are adapted
+  unsigned kerneltime;
+
+  ComputeOptions() : layout(LAYOUT_CONTIGUOUS), persistent(false), devices(DEVICES_GPU),
+    native(false), nativethreads(0), batch(false), histogram(false), audit(false), kerneltime(50) {}
+};
+
+#endif
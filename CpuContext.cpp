@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "CpuContext.h"
+
+#include <cstdint>
+
+#include <numeric>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "sha1.h"
+#include "TSHasherContext.h"
+#include "TSUtil.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+CpuContext::CpuContext(TSHasherContext* tshasherctx,
+  unsigned threads,
+  std::string identitystring) :
+  device_name("Native CPU"),
+  tshasherctx(tshasherctx),
+  threads(threads),
+  backend(Sha1Lanes::selectFastest()),
+  identitystring(std::move(identitystring)),
+  completediterations_total(0),
+  completed_ranges(0),
+  recentspeeds(threads) {
+  bestdifficulty = 0;
+  bestdifficulty_counter = 0;
+
+  // the complete blocks of the public key are the same for every counter
+  const size_t prefixlength = this->identitystring.size() - TSUtil::getTailLength(this->identitystring.size());
+  SHA1 ctx;
+  ctx.update(this->identitystring.substr(0, prefixlength));
+  const std::vector<uint32_t> state = ctx.midstate();
+  for (size_t i = 0; i < 5; i++) {
+    midstate[i] = state[i];
+  }
+  identitytail = this->identitystring.substr(prefixlength);
+
+  for (unsigned t = 0; t < threads; t++) {
+    holders.push_back(tshasherctx->dispenser.addHolder());
+  }
+}
+
+double CpuContext::getAvgSpeed() const {
+  return std::accumulate(recentspeeds.begin(), recentspeeds.end(), 0.0);
+}
+
+std::string CpuContext::getVariantDescription() const {
+  return backend.name + ", " + std::to_string(backend.lanes) + " lanes";
+}
+
+void CpuContext::pinThread(std::thread& thread, unsigned core) {
+#if defined(_WIN32) || defined(_WIN64)
+  if (core < 8 * sizeof(DWORD_PTR)) {
+    SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core);
+  }
+#elif defined(__linux__)
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+#else
+  (void)thread;
+  (void)core;
+#endif
+}
@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef CPUCONTEXT_H_
+#define CPUCONTEXT_H_
+
+#include <cstdint>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Sha1Lanes.h"
+#include "TSHasherContext.h"
+
+
+// forward declaration because of cyclic dependency
+// between CpuContext and TSHasherContext
+class TSHasherContext;
+
+// the native CPU engine, which hashes counter ranges with multi-buffer SHA1
+// on worker threads besides the OpenCL devices (see TSHasherContext::run_cpu_loop)
+class CpuContext {
+public:
+  CpuContext(TSHasherContext* tshasherctx,
+    unsigned threads,
+    std::string identitystring);
+
+  std::string      device_name;
+  TSHasherContext* tshasherctx;
+
+  // number of worker threads, every one is pinned to its own core
+  unsigned          threads;
+  Sha1LanesBackend  backend;
+
+  std::string      identitystring;
+  // the SHA1 state after all complete blocks of the public key
+  uint32_t          midstate[5];
+  // the bytes of the public key after these blocks
+  std::string      identitytail;
+
+  std::mutex        bestdifficulty_mutex;
+  volatile uint8_t      bestdifficulty;
+  volatile uint64_t      bestdifficulty_counter;
+
+  std::atomic<uint64_t> completediterations_total;
+  std::atomic<uint64_t> completed_ranges;
+
+  // the speed of the most recent range of every worker thread
+  std::vector<double> recentspeeds;
+  // the holder of the range of every worker thread in the range dispenser
+  std::vector<size_t> holders;
+
+  double getAvgSpeed() const;
+
+  // the description of the backend and the number of counters it hashes at once
+  std::string getVariantDescription() const;
+
+  // binds the thread to the given core, this is a no-op where it is not supported
+  static void pinThread(std::thread& thread, unsigned core);
+};
+
+#endif
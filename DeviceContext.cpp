@@ -25,6 +25,7 @@ SOFTWARE.
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <numeric>
 #include <string>
 #include <vector>
@@ -35,37 +36,68 @@ SOFTWARE.
 
 const uint64_t DeviceContext::NUM_TIME_MEASURMENTS = 32;
 
+double DifficultyHistogram::getHashes() const {
+  return std::ldexp((double)bins[0], 8);
+}
+
+bool DifficultyHistogram::isPlausible(uint64_t hashes) const {
+  for (cl_uint b = 0; b < BINS; b++) {
+    // the counts are Poisson distributed, we allow six standard deviations
+    // plus some slack for the bins that are expected to be (almost) empty
+    const double expected = std::ldexp((double)hashes, -8 * (int)(b + 1));
+    if (std::abs((double)bins[b] - expected) > 6 * std::sqrt(expected) + 3) {
+      return false;
+    }
+  }
+  return true;
+}
+
 
 DeviceContext::DeviceContext(std::string device_name,
   cl::Device device,
   cl::Context context,
-  cl::Program program,
-  cl::Kernel kernel,
-  cl::Kernel kernel2,
+  KernelGenerator kernelgenerator,
   cl::CommandQueue command_queue,
   TSHasherContext* tshasherctx,
   cl_uint max_compute_units,
   cl_device_type devicetype,
   size_t global_work_size,
   size_t local_work_size,
-  cl::Buffer d_results,
-  cl::Buffer d_identity,
-  uint8_t* h_results,
+  cl_uint vector_size,
+  cl_uint chains,
+  cl_uint digit_batch,
+  std::string kernelvariant,
+  std::vector<LaunchGroup> groups,
+  cl::Buffer d_identitystate,
+  cl::Buffer d_cursor,
+  cl::Buffer d_workqueue,
+  cl::Buffer d_abortword,
+  cl::CommandQueue abort_queue,
   std::string identitystring) :
   device_name(std::move(device_name)),
   device(device),
-  program(program),
-  kernel(kernel),
-  kernel2(kernel2),
+  context(context),
+  kernelgenerator(std::move(kernelgenerator)),
   command_queue(command_queue),
   tshasherctx(tshasherctx),
   max_compute_units(max_compute_units),
   devicetype(devicetype),
   global_work_size(global_work_size),
   local_work_size(local_work_size),
-  d_results(d_results),
-  d_identity(d_identity),
-  h_results(h_results),
+  vector_size(vector_size),
+  chains(chains),
+  digit_batch(digit_batch),
+  kernelvariant(std::move(kernelvariant)),
+  groups(std::move(groups)),
+  d_identitystate(d_identitystate),
+  d_cursor(d_cursor),
+  d_workqueue(d_workqueue),
+  d_abortword(d_abortword),
+  abort_queue(abort_queue),
+  auditrng(std::random_device()()),
+  audittime_ns(0),
+  audited_items(0),
+  failed_audits(0),
   identitystring(std::move(identitystring)),
   recenttimes(NUM_TIME_MEASURMENTS),
   recentiterations(NUM_TIME_MEASURMENTS) {
@@ -76,10 +108,19 @@ DeviceContext::DeviceContext(std::string device_name,
   schedulediterations_total = 0;
   completediterations_total = 0;
   completed_kernels = 0;
+  launchiterations = 1;
+  workqueue.published = 0;
+  idletime_ns = 0;
+  idlegaps = 0;
+  lastkernelend = 0;
   timer_started = false;
   timecounter = 0;
 }
 
+uint64_t DeviceContext::getCountersPerItem() const {
+  return static_cast<uint64_t>(vector_size) * chains * digit_batch;
+}
+
 void DeviceContext::measureTime() {
   auto currenttime = std::chrono::high_resolution_clock::now();
   if (timer_started) {
@@ -105,6 +146,22 @@ double DeviceContext::getAvgSpeed() const {
   return totaliterations / seconds;
 }
 
+uint64_t DeviceContext::adaptLaunchIterations(double targetseconds, uint64_t maxiterations) {
+  if (timecounter > 0) {
+    const double iterationspersecond = getAvgSpeed() / ((double)global_work_size * getCountersPerItem());
+    // the speed is averaged over the recent launches, so it lags behind a change of the iterations,
+    // which is why they at most double or halve per launch
+    const double ideal = targetseconds * iterationspersecond;
+    const double next = std::min(std::max(ideal, launchiterations / 2.0), launchiterations * 2.0);
+    launchiterations = std::min(maxiterations, std::max((uint64_t)1, (uint64_t)next));
+  }
+  return launchiterations;
+}
+
+double DeviceContext::getAvgIdleGap() const {
+  return idlegaps == 0 ? 0 : idletime_ns / 1e9 / idlegaps;
+}
+
 std::chrono::duration<uint64_t, std::nano> DeviceContext::getRecentMinTime() const {
   return *std::min_element(recenttimes.begin(), recenttimes.end());
 }
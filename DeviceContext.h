@@ -25,12 +25,16 @@ SOFTWARE.
 #include <cstdint>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <numeric>
+#include <random>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <CL/cl.hpp>
+#include "KernelGenerator.h"
 #include "TSHasherContext.h"
 
 
@@ -38,31 +42,145 @@ SOFTWARE.
 // between DeviceContext and TSHasherContext
 class TSHasherContext;
 
+// a counter reported by a kernel together with the difficulty of its hash
+// (this has to match hit_t in Kernel.h)
+struct HitRecord {
+  cl_ulong counter;
+  cl_uint difficulty;
+  // the index of the identity within the batch (only set by the batch kernel)
+  cl_uint identity;
+};
+
+// an identity of a batch kernel launch, which owns the work groups from firstgroup up to
+// the first group of the next entry, of which the first items work items hash its counters
+// (this has to match batchentry_t in Kernel.h)
+struct BatchEntry {
+  static const cl_uint MAX_IDENTITIES = 64;
+
+  cl_ulong startcounter;
+  cl_uint firstgroup;
+  cl_uint items;
+  cl_uint iterations;
+  cl_uint targetdifficulty;
+  // the index of the identity within the batch
+  cl_uint identity;
+  cl_uint reserved;
+};
+
+// the difficulties of the hashes of a device, as counted by the kernels
+// bin b counts the hashes with a difficulty of at least 8*(b+1) (see countDifficulties in Kernel.h),
+// which is an independent check of the number of hashes the device reports
+struct DifficultyHistogram {
+  static const cl_uint BINS = 4;
+
+  uint64_t bins[BINS];
+
+  DifficultyHistogram() : bins() {}
+
+  // the number of hashes implied by the first bin
+  double getHashes() const;
+
+  // whether every bin is within the statistical error of its expectation for the given number of hashes
+  bool isPlausible(uint64_t hashes) const;
+};
+
+// the buffers of one kernel launch, which belong to it until its results have been read
+// the hit count, the hits and the histogram are sub-buffers of the region of the launch in the results
+// of its group, the host pointers are only valid while the group is mapped
+// (see TSHasherContext::readResults and TSHasherContext::releaseResults)
+struct LaunchSlot {
+  cl::Buffer d_hitcount;
+  cl::Buffer d_hits;
+  cl_uint* h_hitcount;
+  HitRecord* h_hits;
+  // the hits the kernel has dropped, since they did not fit into its hit buffer,
+  // the host hashes the range of the launch again if there are any (see read_kernel_result)
+  cl_uint droppedhits;
+  // the progress is only written by aborted work items, all others have completed
+  cl::Buffer d_progress;
+  std::vector<uint32_t> h_progress;
+  // the checksum of every work item (only written by kernels built with COVERAGE_AUDIT)
+  cl::Buffer d_checksums;
+  cl_uint* h_checksum;
+  // the kernels add to the histogram (only if they are built with DIFFICULTY_HISTOGRAM),
+  // which is cleared whenever it has been read
+  cl::Buffer d_histogram;
+  cl_uint* h_histogram;
+
+  // the range of the launch
+  uint64_t startcounter;
+  uint64_t iterations;
+  size_t global_work_size;
+  uint64_t scheduledcounters;
+  // the holder of the range in the range dispenser until its results have been evaluated
+  size_t holder;
+  // the best difficulty among the counters the host has hashed after the kernel range
+  std::pair<uint8_t, uint64_t> hostbest;
+  // the audited work item, of which the host recomputes the checksum once the results have been read
+  bool audited;
+  size_t audititem;
+
+  cl::Event kernelevent;
+};
+
+// launches that are enqueued back to back and whose results are read at once
+// run_kernel_loop keeps several groups in flight, the other loops only use the first launch of the first group
+struct LaunchGroup {
+  // every launch writes its hit count, its histogram and its hits into its own region
+  cl::Buffer d_results;
+  uint8_t* h_results;
+  size_t regionsize;
+  size_t histogramoffset;
+  size_t hitsoffset;
+
+  std::vector<LaunchSlot> launches;
+  // the number of launches that have been enqueued
+  size_t launched;
+  // completes once the results of all launches have been read to the host
+  cl::Event resultevent;
+};
+
+// the work queue of the persistent kernel, which the host writes before every launch
+// (the host cannot update it while the kernel runs, OpenCL 1.2 does not make such writes visible to the kernel)
+// (this has to match workqueue_t in Kernel.h)
+struct WorkQueue {
+  static const cl_uint MAX_LEASES = 64;
+
+  // the number of leases the kernel may claim chunks from
+  cl_uint published;
+  cl_uint reserved;
+  // the first counter of every published lease
+  cl_ulong leasestart[MAX_LEASES];
+};
+
 class DeviceContext {
 public:
   DeviceContext(std::string device_name,
     cl::Device device,
     cl::Context context,
-    cl::Program program,
-    cl::Kernel kernel,
-    cl::Kernel kernel2,
+    KernelGenerator kernelgenerator,
     cl::CommandQueue command_queue,
     TSHasherContext* tshasherctx,
     cl_uint max_compute_units,
     cl_device_type devicetype,
     size_t global_work_size,
     size_t local_work_size,
-    cl::Buffer d_results,
-    cl::Buffer d_identity,
-    uint8_t* h_results,
+    cl_uint vector_size,
+    cl_uint chains,
+    cl_uint digit_batch,
+    std::string kernelvariant,
+    std::vector<LaunchGroup> groups,
+    cl::Buffer d_identitystate,
+    cl::Buffer d_cursor,
+    cl::Buffer d_workqueue,
+    cl::Buffer d_abortword,
+    cl::CommandQueue abort_queue,
     std::string identitystring);
 
   std::string      device_name;
   cl::Device      device;
   cl::Context         context;
-  cl::Program         program;
-  cl::Kernel          kernel;
-  cl::Kernel          kernel2;
+  KernelGenerator     kernelgenerator;
   cl::CommandQueue    command_queue;
 
   TSHasherContext* tshasherctx;
@@ -73,13 +191,44 @@ public:
 
   size_t            global_work_size;
   size_t            local_work_size;
+  // number of counters every work item hashes at once
+  cl_uint           vector_size;
+  // number of independent sets of vector_size counters every work item hashes
+  cl_uint           chains;
+  // number of consecutive counters every lane hashes per iteration
+  cl_uint           digit_batch;
+  // the description of the tuned kernel variant
+  std::string      kernelvariant;
 
-  cl::Buffer          d_results;
-  cl::Buffer      d_identity;
-  uint8_t* h_results;
+  std::vector<LaunchGroup>      groups;
+  cl::Buffer      d_identitystate;
+
+  // only used by the persistent kernel
+  cl::Buffer      d_cursor;
+  cl::Buffer      d_workqueue;
+  WorkQueue      workqueue;
 
-  cl::Event      kernelcompletedevent;
-  cl::Event      resultavailableevent;
+  // the running kernels poll the abort word and report the iterations every work item
+  // has completed once they abort, the host writes it through a second in-order queue,
+  // since the command queue of the kernels only executes the write after them
+  // (a kernel that does not see the write in time just completes its range)
+  cl::Buffer      d_abortword;
+  cl::CommandQueue      abort_queue;
+
+  // the difficulty histogram of all kernels of the device
+  DifficultyHistogram      histogram;
+
+  // the host recomputes the checksum of one work item per audited launch
+  // (the thread reading the results adds the nanoseconds this takes, the thread launching the kernels reads them)
+  std::minstd_rand      auditrng;
+  std::atomic<uint64_t>      audittime_ns;
+  uint64_t      audited_items;
+  uint64_t      failed_audits;
+
+  // the time the device spends between the kernels of run_kernel_loop, as profiled by the command queue
+  uint64_t      idletime_ns;
+  uint64_t      idlegaps;
+  cl_ulong      lastkernelend;
 
   volatile uint8_t      bestdifficulty;
   volatile uint64_t      bestdifficulty_counter;
@@ -90,14 +239,30 @@ public:
   uint64_t      completediterations_total;
   uint64_t      completed_kernels;
 
+  // the iterations every work item runs per launch, adapted to the target kernel time
+  uint64_t      launchiterations;
+
+  // the holder of the leases of the persistent kernel in the range dispenser
+  size_t        leaseholder;
+
   std::string      identitystring;
 
+  // number of counters every work item hashes per iteration
+  uint64_t getCountersPerItem() const;
+
   void measureTime();
 
   std::chrono::duration<uint64_t, std::nano> getCurrentKernelRunningTime();
 
   double getAvgSpeed() const;
 
+  // adapts the iterations per launch such that a launch of the whole grid takes about
+  // targetseconds at the recently measured speed and returns them
+  uint64_t adaptLaunchIterations(double targetseconds, uint64_t maxiterations);
+
+  // the average time between the end of a kernel and the start of the next one
+  double getAvgIdleGap() const;
+
   std::chrono::duration<uint64_t, std::nano> getRecentMinTime() const;
 
   std::chrono::duration<uint64_t, std::nano> getRecentMaxTime() const;
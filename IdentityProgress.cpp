@@ -29,16 +29,20 @@ const char* IdentityProgress::NICKNAME_STR = "nickname";
 const char* IdentityProgress::IDENTITY_STR = "identity";
 const char* IdentityProgress::CURRENTCOUNTER = "currentcounter";
 const char* IdentityProgress::BESTCOUNTER = "bestcounter";
+const char* IdentityProgress::WEIGHT = "weight";
+const uint64_t IdentityProgress::MAX_WEIGHT = (uint64_t)1 << 32;
 
-IdentityProgress::IdentityProgress()
+IdentityProgress::IdentityProgress() :
+  weight(1)
 {}
 
 IdentityProgress::IdentityProgress(std::string nickname,
   std::string identity,
   uint64_t currentcounter,
-  uint64_t bestcounter) :
+  uint64_t bestcounter,
+  uint64_t weight) :
   nickname(std::move(nickname)), identity(std::move(identity)),
-  currentcounter(currentcounter), bestcounter(bestcounter)
+  currentcounter(currentcounter), bestcounter(bestcounter), weight(weight)
 {}
 
 std::string IdentityProgress::toIniString() const {
@@ -49,14 +53,19 @@ std::string IdentityProgress::toIniString() const {
   out << string(IDENTITY_STR) << "=" << identity << endl;
   out << string(CURRENTCOUNTER) << "=" << currentcounter << endl;
   out << string(BESTCOUNTER) << "=" << bestcounter << endl;
+  // the default weight is omitted, such that older versions can still read the file
+  if (weight != 1) {
+    out << string(WEIGHT) << "=" << weight << endl;
+  }
   return out.str();
 }
 
 IdentityProgress IdentityProgress::parse(const std::string& segment) {
   std::string nickname;
   std::string identity;
-  uint64_t currentcounter;
-  uint64_t bestcounter;
+  uint64_t currentcounter = 0;
+  uint64_t bestcounter = 0;
+  uint64_t weight = 1;
 
   bool nickname_set = false;
   bool identity_set = false;
@@ -74,6 +83,7 @@ IdentityProgress IdentityProgress::parse(const std::string& segment) {
       auto prefix_identity(string(IDENTITY_STR) + "=");
       auto prefix_currentcounter(string(CURRENTCOUNTER) + "=");
       auto prefix_bestcounter(string(BESTCOUNTER) + "=");
+      auto prefix_weight(string(WEIGHT) + "=");
 
       if (entry.compare(0, prefix_nickname.size(), prefix_nickname) == 0) {
         nickname = entry.substr(prefix_nickname.size());
@@ -91,6 +101,12 @@ IdentityProgress IdentityProgress::parse(const std::string& segment) {
         bestcounter = stoull(entry.substr(prefix_bestcounter.size()));
         bestcounter_set = true;
       }
+      else if (entry.compare(0, prefix_weight.size(), prefix_weight) == 0) {
+        weight = stoull(entry.substr(prefix_weight.size()));
+        if (weight == 0 || weight > MAX_WEIGHT) {
+          throw std::invalid_argument("Identity section is invalid.");
+        }
+      }
       else {
         // we are evaluating this in a strict manner
         // disallowing any unknown entry names
@@ -115,5 +131,5 @@ IdentityProgress IdentityProgress::parse(const std::string& segment) {
     bestcounter = currentcounter;
   }
 
-  return IdentityProgress(nickname, identity, currentcounter, bestcounter);
+  return IdentityProgress(nickname, identity, currentcounter, bestcounter, weight);
 }
@@ -32,17 +32,23 @@ public:
   std::string identity;
   uint64_t currentcounter;
   uint64_t bestcounter;
+  // the share of the device time the identity gets when it is computed in a batch
+  uint64_t weight;
 
   IdentityProgress();
   IdentityProgress(std::string nickname,
     std::string identity,
     uint64_t currentcounter,
-    uint64_t bestcounter);
+    uint64_t bestcounter,
+    uint64_t weight);
 
   static const char* NICKNAME_STR;
   static const char* IDENTITY_STR;
   static const char* CURRENTCOUNTER;
   static const char* BESTCOUNTER;
+  static const char* WEIGHT;
+  // the weights of a batch are summed up, which must not overflow
+  static const uint64_t MAX_WEIGHT;
 
 
   std::string toIniString() const;
@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "IdentityState.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sha1.h"
+#include "TSUtil.h"
+
+const size_t IdentityState::MIDSTATE_OFFSET = 0;
+const size_t IdentityState::TAIL_OFFSET = 5;
+const size_t IdentityState::PRECOMPUTED_STATE_OFFSET = 5 + 16;
+const size_t IdentityState::PRECOMPUTED_EXPANSION_OFFSET = 5 + 16 + 5;
+const size_t IdentityState::KERNEL_BUFFER_WORDS = 5 + 16 + 5 + 16;
+
+static uint32_t rol(const uint32_t value, const size_t bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+IdentityState::IdentityState(const std::string& publickey) :
+  identity_length(publickey.size()) {
+  const size_t prefix_length = identity_length - TSUtil::getTailLength(identity_length);
+  SHA1 ctx;
+  ctx.update(publickey.substr(0, prefix_length));
+  std::vector<uint32_t> state = ctx.midstate();
+  for (size_t i = 0; i < 5; i++) {
+    midstate[i] = state[i];
+  }
+
+  for (size_t i = 0; i < 16; i++) {
+    tail[i] = 0;
+  }
+  for (size_t i = prefix_length; i < publickey.size(); i++) {
+    const size_t pos = i - prefix_length;
+    tail[pos / 4] |= (static_cast<uint32_t>(publickey[i]) & 0xff) << (8 * (3 - pos % 4));
+  }
+
+  constant_words = (identity_length - prefix_length) / 4;
+  precomputeConstantRounds();
+}
+
+void IdentityState::precomputeConstantRounds() {
+  uint32_t state[5];
+  for (size_t i = 0; i < 5; i++) {
+    state[i] = midstate[i];
+  }
+
+  // these are the first rounds of SHA1, which only use the message words directly
+  for (size_t round = 0; round < constant_words; round++) {
+    const uint32_t f = (state[1] & state[2]) | (~state[1] & state[3]);
+    const uint32_t temp = rol(state[0], 5) + f + state[4] + 0x5a827999 + tail[round];
+    state[4] = state[3];
+    state[3] = state[2];
+    state[2] = rol(state[1], 30);
+    state[1] = state[0];
+    state[0] = temp;
+  }
+
+  // the kernel does not shift the state between rounds but rotates the roles
+  // of its variables, so after k rounds the variable of index i holds state[(i+k)%5]
+  for (size_t i = 0; i < 5; i++) {
+    precomputed_state[i] = state[(i + constant_words) % 5];
+  }
+
+  // the i-th expanded word is computed from the words i+13, i+8, i+2 and i
+  const size_t terms[4] = { 13, 8, 2, 0 };
+  for (size_t i = 0; i < 16; i++) {
+    precomputed_expansion[i] = 0;
+    for (size_t term : terms) {
+      if (i + term < constant_words) {
+        precomputed_expansion[i] ^= tail[i + term];
+      }
+    }
+  }
+}
+
+std::vector<uint32_t> IdentityState::toKernelBuffer() const {
+  std::vector<uint32_t> buffer(KERNEL_BUFFER_WORDS);
+  for (size_t i = 0; i < 5; i++) {
+    buffer[MIDSTATE_OFFSET + i] = midstate[i];
+  }
+  for (size_t i = 0; i < 16; i++) {
+    buffer[TAIL_OFFSET + i] = tail[i];
+  }
+  for (size_t i = 0; i < 5; i++) {
+    buffer[PRECOMPUTED_STATE_OFFSET + i] = precomputed_state[i];
+  }
+  for (size_t i = 0; i < 16; i++) {
+    buffer[PRECOMPUTED_EXPANSION_OFFSET + i] = precomputed_expansion[i];
+  }
+  return buffer;
+}
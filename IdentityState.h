@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef IDENTITYSTATE_H_
+#define IDENTITYSTATE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Holds everything about a public key that the kernels would otherwise
+// recompute for every work item.
+// The layout of toKernelBuffer() has to match the IDENTITYSTATE_* offsets
+// used in Kernel.h.
+class IdentityState {
+public:
+  explicit IdentityState(const std::string& publickey);
+
+  // the SHA1 state after compressing all complete 64 byte blocks of the public key
+  uint32_t midstate[5];
+  // the remaining bytes of the public key in 32bit big endian form,
+  // padded with zeros to a full block
+  uint32_t tail[16];
+
+  // the number of leading tail words that do not hold any part of the counter
+  size_t constant_words;
+  // the state after the first constant_words rounds of the tail block,
+  // ordered by the variables of the unrolled kernel code (a, b, c, d, e)
+  uint32_t precomputed_state[5];
+  // the xor of all constant words that enter the first 16 expanded words
+  uint32_t precomputed_expansion[16];
+
+  size_t identity_length;
+
+  std::vector<uint32_t> toKernelBuffer() const;
+
+  static const size_t MIDSTATE_OFFSET;
+  static const size_t TAIL_OFFSET;
+  static const size_t PRECOMPUTED_STATE_OFFSET;
+  static const size_t PRECOMPUTED_EXPANSION_OFFSET;
+  static const size_t KERNEL_BUFFER_WORDS;
+
+private:
+  void precomputeConstantRounds();
+};
+
+#endif
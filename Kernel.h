@@ -59,26 +59,24 @@ typedef enum sha1_constants
 
 } sha1_constants_t;
 
-#ifdef IS_NV
 #define SHA1_F0(x,y,z)  ((z) ^ ((x) & ((y) ^ (z))))
 #define SHA1_F1(x,y,z)  ((x) ^ (y) ^ (z))
 #define SHA1_F2(x,y,z)  (((x) & (y)) | ((z) & ((x) ^ (y))))
-#define SHA1_F0o(x,y,z) (bitselect ((z), (y), (x)))
-#define SHA1_F2o(x,y,z) (bitselect ((x), (y), ((x) ^ (z))))
+
+// whether the select functions are implemented with bitselect is a kernel variant
+// (see TunedParameters), by default it is used on NVIDIA and AMD devices
+#ifndef USE_BITSELECT
+#ifdef IS_GENERIC
+#define USE_BITSELECT 0
+#else
+#define USE_BITSELECT 1
+#endif
 #endif
 
-#ifdef IS_AMD
-#define SHA1_F0(x,y,z)  ((z) ^ ((x) & ((y) ^ (z))))
-#define SHA1_F1(x,y,z)  ((x) ^ (y) ^ (z))
-#define SHA1_F2(x,y,z)  (((x) & (y)) | ((z) & ((x) ^ (y))))
+#if USE_BITSELECT
 #define SHA1_F0o(x,y,z) (bitselect ((z), (y), (x)))
 #define SHA1_F2o(x,y,z) (bitselect ((x), (y), ((x) ^ (z))))
-#endif
-
-#ifdef IS_GENERIC
-#define SHA1_F0(x,y,z)  ((z) ^ ((x) & ((y) ^ (z))))
-#define SHA1_F1(x,y,z)  ((x) ^ (y) ^ (z))
-#define SHA1_F2(x,y,z)  (((x) & (y)) | ((z) & ((x) ^ (y))))
+#else
 #define SHA1_F0o(x,y,z) (SHA1_F0 ((x), (y), (z)))
 #define SHA1_F2o(x,y,z) (SHA1_F2 ((x), (y), (z)))
 #endif
@@ -89,8 +87,8 @@ typedef enum sha1_constants
   e += K;                           \
   e += x;                           \
   e += f (b, c, d);                 \
-  e += rotate (a,  5u);             \
-  b  = rotate (b, 30u);             \
+  e += rotl32 (a,  5u);             \
+  b  = rotl32 (b, 30u);             \
 }
 
 typedef uchar  u8;
@@ -98,32 +96,118 @@ typedef ushort u16;
 typedef uint   u32;
 typedef ulong  u64;
 
+// every work item hashes VECT_SIZE counters at once, one in each lane, such that
+// all state and digest words are held as structure of arrays
+// the vector size 16 is only used on CPU devices, where one u32x fills an AVX-512 register
+#if VECT_SIZE == 1
+typedef uint    u32x;
+typedef ulong   u64x;
+#define LANE_IDS 0
+#define convert_u32x convert_uint
+#elif VECT_SIZE == 2
+typedef uint2   u32x;
+typedef ulong2  u64x;
+#define LANE_IDS ((u64x)(0, 1))
+#define convert_u32x convert_uint2
+#define vstore_x vstore2
+#elif VECT_SIZE == 4
+typedef uint4   u32x;
+typedef ulong4  u64x;
+#define LANE_IDS ((u64x)(0, 1, 2, 3))
+#define convert_u32x convert_uint4
+#define vstore_x vstore4
+#elif VECT_SIZE == 8
+typedef uint8   u32x;
+typedef ulong8  u64x;
+#define LANE_IDS ((u64x)(0, 1, 2, 3, 4, 5, 6, 7))
+#define convert_u32x convert_uint8
+#define vstore_x vstore8
+#elif VECT_SIZE == 16
+typedef uint16  u32x;
+typedef ulong16 u64x;
+#define LANE_IDS ((u64x)(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))
+#define convert_u32x convert_uint16
+#define vstore_x vstore16
+#endif
 
-void sha1_64 (u32 block[16], u32 digest[5])
+// note that scalar comparisons yield 1, whereas vector comparisons yield -1
+#if VECT_SIZE == 1
+#define ANY_ZERO(x)    ((x) == 0)
+#define ANY_NONZERO(x) ((x) != 0)
+#else
+#define ANY_ZERO(x)    any ((x) == 0)
+#define ANY_NONZERO(x) any ((x) != 0)
+#endif
+
+// writes the lanes of x to the private array p
+#if VECT_SIZE == 1
+#define STORE_LANES(x,p) ((p)[0] = (x))
+#else
+#define STORE_LANES(x,p) vstore_x ((x), 0, (p))
+#endif
+
+#define rotl32(a,n) rotate ((a), (u32x) (n))
+
+// every program is specialized for one identity and one counter length
+// (see KernelGenerator::getBuildOptions), which are passed as
+//   IDENTITY_LENGTH  the length of the public key in bytes
+//   COUNTER_LENGTH   the number of decimal digits of all counters
+// everything below is derived from these at compile time
+
+// the number of bytes of the public key after its complete blocks,
+// the midstate of these blocks is computed on the host (see IdentityState)
+#define TAIL_LENGTH (IDENTITY_LENGTH % 64)
+// the byte position of the 0x80 padding after the counter
+#define PADDING_POS (TAIL_LENGTH + COUNTER_LENGTH)
+// the slow phase needs a second block for the padding and the length
+#define SLOW_PHASE  (PADDING_POS + 1 + 8 > 64)
+// for long tails, the counter itself reaches into the second block,
+// which then differs between the counters and is hashed for every one of them
+#define COUNTER_SPILLS (PADDING_POS > 64)
+#define MESSAGE_WORDS (SLOW_PHASE ? 32 : 16)
+// the (big endian) message length in bits occupies the last two words
+#define LENGTH_WORD_HI (MESSAGE_WORDS - 2)
+#define LENGTH_WORD_LO (MESSAGE_WORDS - 1)
+#define MESSAGE_BITS  (8 * (IDENTITY_LENGTH + COUNTER_LENGTH))
+// the words [COUNTER_WORDS_START, COUNTER_WORDS_END) hold the counter
+#define COUNTER_WORDS_START (TAIL_LENGTH / 4)
+#define COUNTER_WORDS_END   ((PADDING_POS + 3) / 4)
+
+// word offsets within the identity state buffer
+// (see IdentityState::toKernelBuffer)
+#define IDENTITYSTATE_MIDSTATE     0
+#define IDENTITYSTATE_TAIL         5
+#define IDENTITYSTATE_PC_STATE     21
+#define IDENTITYSTATE_PC_EXPANSION 26
+// the states of a batch of identities follow each other
+#define IDENTITYSTATE_WORDS        42
+
+
+void sha1_64 (u32x block[16], u32x digest[5])
 {
 
-  u32 a = digest[0];
-  u32 b = digest[1];
-  u32 c = digest[2];
-  u32 d = digest[3];
-  u32 e = digest[4];
-
-  u32 w0_t = block[ 0];
-  u32 w1_t = block[ 1];
-  u32 w2_t = block[ 2];
-  u32 w3_t = block[ 3];
-  u32 w4_t = block[ 4];
-  u32 w5_t = block[ 5];
-  u32 w6_t = block[ 6];
-  u32 w7_t = block[ 7];
-  u32 w8_t = block[ 8];
-  u32 w9_t = block[ 9];
-  u32 wa_t = block[10];
-  u32 wb_t = block[11];
-  u32 wc_t = block[12];
-  u32 wd_t = block[13];
-  u32 we_t = block[14];
-  u32 wf_t = block[15];
+  u32x a = digest[0];
+  u32x b = digest[1];
+  u32x c = digest[2];
+  u32x d = digest[3];
+  u32x e = digest[4];
+
+  u32x w0_t = block[ 0];
+  u32x w1_t = block[ 1];
+  u32x w2_t = block[ 2];
+  u32x w3_t = block[ 3];
+  u32x w4_t = block[ 4];
+  u32x w5_t = block[ 5];
+  u32x w6_t = block[ 6];
+  u32x w7_t = block[ 7];
+  u32x w8_t = block[ 8];
+  u32x w9_t = block[ 9];
+  u32x wa_t = block[10];
+  u32x wb_t = block[11];
+  u32x wc_t = block[12];
+  u32x wd_t = block[13];
+  u32x we_t = block[14];
+  u32x wf_t = block[15];
 
   #undef K
   #define K SHA1C00
@@ -145,145 +229,145 @@ void sha1_64 (u32 block[16], u32 digest[5])
   SHA1_STEP (SHA1_F0o, b, c, d, e, a, we_t);
   SHA1_STEP (SHA1_F0o, a, b, c, d, e, wf_t);
  
-  w0_t = rotate ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
   SHA1_STEP (SHA1_F0o, e, a, b, c, d, w0_t);
-  w1_t = rotate ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
   SHA1_STEP (SHA1_F0o, d, e, a, b, c, w1_t);
-  w2_t = rotate ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
   SHA1_STEP (SHA1_F0o, c, d, e, a, b, w2_t);
-  w3_t = rotate ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
   SHA1_STEP (SHA1_F0o, b, c, d, e, a, w3_t);
 
   #undef K
   #define K SHA1C01
 
-  w4_t = rotate ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, w4_t);
-  w5_t = rotate ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, w5_t);
-  w6_t = rotate ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, w6_t);
-  w7_t = rotate ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, w7_t);
-  w8_t = rotate ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, w8_t);
-  w9_t = rotate ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, w9_t);
-  wa_t = rotate ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, wa_t);
-  wb_t = rotate ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, wb_t);
-  wc_t = rotate ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, wc_t);
-  wd_t = rotate ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, wd_t);
-  we_t = rotate ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, we_t);
-  wf_t = rotate ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, wf_t);
-  w0_t = rotate ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, w0_t);
-  w1_t = rotate ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, w1_t);
-  w2_t = rotate ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, w2_t);
-  w3_t = rotate ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, w3_t);
-  w4_t = rotate ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, w4_t);
-  w5_t = rotate ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, w5_t);
-  w6_t = rotate ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, w6_t);
-  w7_t = rotate ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, w7_t);
 
   #undef K
   #define K SHA1C02
 
-  w8_t = rotate ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
   SHA1_STEP (SHA1_F2o, a, b, c, d, e, w8_t);
-  w9_t = rotate ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
   SHA1_STEP (SHA1_F2o, e, a, b, c, d, w9_t);
-  wa_t = rotate ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
   SHA1_STEP (SHA1_F2o, d, e, a, b, c, wa_t);
-  wb_t = rotate ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
   SHA1_STEP (SHA1_F2o, c, d, e, a, b, wb_t);
-  wc_t = rotate ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
   SHA1_STEP (SHA1_F2o, b, c, d, e, a, wc_t);
-  wd_t = rotate ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
   SHA1_STEP (SHA1_F2o, a, b, c, d, e, wd_t);
-  we_t = rotate ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
   SHA1_STEP (SHA1_F2o, e, a, b, c, d, we_t);
-  wf_t = rotate ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
   SHA1_STEP (SHA1_F2o, d, e, a, b, c, wf_t);
-  w0_t = rotate ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
   SHA1_STEP (SHA1_F2o, c, d, e, a, b, w0_t);
-  w1_t = rotate ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
   SHA1_STEP (SHA1_F2o, b, c, d, e, a, w1_t);
-  w2_t = rotate ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
   SHA1_STEP (SHA1_F2o, a, b, c, d, e, w2_t);
-  w3_t = rotate ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
   SHA1_STEP (SHA1_F2o, e, a, b, c, d, w3_t);
-  w4_t = rotate ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
   SHA1_STEP (SHA1_F2o, d, e, a, b, c, w4_t);
-  w5_t = rotate ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
   SHA1_STEP (SHA1_F2o, c, d, e, a, b, w5_t);
-  w6_t = rotate ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
   SHA1_STEP (SHA1_F2o, b, c, d, e, a, w6_t);
-  w7_t = rotate ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
   SHA1_STEP (SHA1_F2o, a, b, c, d, e, w7_t);
-  w8_t = rotate ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
   SHA1_STEP (SHA1_F2o, e, a, b, c, d, w8_t);
-  w9_t = rotate ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
   SHA1_STEP (SHA1_F2o, d, e, a, b, c, w9_t);
-  wa_t = rotate ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
   SHA1_STEP (SHA1_F2o, c, d, e, a, b, wa_t);
-  wb_t = rotate ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
   SHA1_STEP (SHA1_F2o, b, c, d, e, a, wb_t);
 
   #undef K
   #define K SHA1C03
 
-  wc_t = rotate ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, wc_t);
-  wd_t = rotate ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, wd_t);
-  we_t = rotate ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, we_t);
-  wf_t = rotate ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, wf_t);
-  w0_t = rotate ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, w0_t);
-  w1_t = rotate ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, w1_t);
-  w2_t = rotate ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, w2_t);
-  w3_t = rotate ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, w3_t);
-  w4_t = rotate ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, w4_t);
-  w5_t = rotate ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, w5_t);
-  w6_t = rotate ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, w6_t);
-  w7_t = rotate ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, w7_t);
-  w8_t = rotate ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, w8_t);
-  w9_t = rotate ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, w9_t);
-  wa_t = rotate ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, wa_t);
-  wb_t = rotate ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
   SHA1_STEP (SHA1_F1, a, b, c, d, e, wb_t);
-  wc_t = rotate ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
   SHA1_STEP (SHA1_F1, e, a, b, c, d, wc_t);
-  wd_t = rotate ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
   SHA1_STEP (SHA1_F1, d, e, a, b, c, wd_t);
-  we_t = rotate ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
   SHA1_STEP (SHA1_F1, c, d, e, a, b, we_t);
-  wf_t = rotate ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
   SHA1_STEP (SHA1_F1, b, c, d, e, a, wf_t);
 
   digest[0] += a;
@@ -293,32 +377,217 @@ void sha1_64 (u32 block[16], u32 digest[5])
   digest[4] += e;
 }
 
-ulong countertostring(char* dst, ulong c) {
-  if (c==0) { *dst = '0'; return 1; }
-  char* dst0 = dst;
-  char* dst1 = dst;
-  ulong counterlength=0;
-  while (c) {
-    uchar currentdigit = c%10;
-    *dst1 = '0'+currentdigit;
-    dst1++;
-    counterlength++;
-    c = c/10;
-  }
-  // invert string
-  
-  dst1--;
-  while (dst0 < dst1) {
-    uchar tmp = *dst0;
-    *dst0 = *dst1;
-    *dst1 = tmp;
-    dst0++;
-    dst1--;
-  }
-  
-  return counterlength;
-}
+// The first CONST_WORDS words of the last block(s) only hold the tail of the
+// identity, i.e., they are the same for every counter. Hence, the host
+// computes the state after the first CONST_WORDS rounds, as well as the part
+// of the first 16 expanded words that only depends on these constant words.
+#define CONST_WORDS COUNTER_WORDS_START
+
+#define SHA1_STEP_PC(i,f,a,b,c,d,e,x) if ((i) >= CONST_WORDS) SHA1_STEP (f, a, b, c, d, e, x)
 
+#define SHA1_TERM_PC(i,x) (((i) < CONST_WORDS) ? (u32x) 0 : (x))
+
+#define SHA1_EXPAND_PC(i,x3,x8,x14,x16)                   \
+  rotl32 ((SHA1_TERM_PC ((i)+13, x3) ^                   \
+           SHA1_TERM_PC ((i)+ 8, x8) ^                   \
+           SHA1_TERM_PC ((i)+ 2, x14) ^                  \
+           SHA1_TERM_PC ((i)   , x16) ^                  \
+           (((i) < CONST_WORDS) ? expansion[i] : 0)), 1u)
+
+void sha1_64_precomputed (u32x block[16], u32x digest[5],
+                          const u32 state[5], const u32 expansion[16])
+{
+
+  u32x a = state[0];
+  u32x b = state[1];
+  u32x c = state[2];
+  u32x d = state[3];
+  u32x e = state[4];
+
+  u32x w0_t = block[ 0];
+  u32x w1_t = block[ 1];
+  u32x w2_t = block[ 2];
+  u32x w3_t = block[ 3];
+  u32x w4_t = block[ 4];
+  u32x w5_t = block[ 5];
+  u32x w6_t = block[ 6];
+  u32x w7_t = block[ 7];
+  u32x w8_t = block[ 8];
+  u32x w9_t = block[ 9];
+  u32x wa_t = block[10];
+  u32x wb_t = block[11];
+  u32x wc_t = block[12];
+  u32x wd_t = block[13];
+  u32x we_t = block[14];
+  u32x wf_t = block[15];
+
+  #undef K
+  #define K SHA1C00
+
+  SHA1_STEP_PC ( 0, SHA1_F0o, a, b, c, d, e, w0_t);
+  SHA1_STEP_PC ( 1, SHA1_F0o, e, a, b, c, d, w1_t);
+  SHA1_STEP_PC ( 2, SHA1_F0o, d, e, a, b, c, w2_t);
+  SHA1_STEP_PC ( 3, SHA1_F0o, c, d, e, a, b, w3_t);
+  SHA1_STEP_PC ( 4, SHA1_F0o, b, c, d, e, a, w4_t);
+  SHA1_STEP_PC ( 5, SHA1_F0o, a, b, c, d, e, w5_t);
+  SHA1_STEP_PC ( 6, SHA1_F0o, e, a, b, c, d, w6_t);
+  SHA1_STEP_PC ( 7, SHA1_F0o, d, e, a, b, c, w7_t);
+  SHA1_STEP_PC ( 8, SHA1_F0o, c, d, e, a, b, w8_t);
+  SHA1_STEP_PC ( 9, SHA1_F0o, b, c, d, e, a, w9_t);
+  SHA1_STEP_PC (10, SHA1_F0o, a, b, c, d, e, wa_t);
+  SHA1_STEP_PC (11, SHA1_F0o, e, a, b, c, d, wb_t);
+  SHA1_STEP_PC (12, SHA1_F0o, d, e, a, b, c, wc_t);
+  SHA1_STEP_PC (13, SHA1_F0o, c, d, e, a, b, wd_t);
+  SHA1_STEP_PC (14, SHA1_F0o, b, c, d, e, a, we_t);
+  SHA1_STEP_PC (15, SHA1_F0o, a, b, c, d, e, wf_t);
+ 
+  w0_t = SHA1_EXPAND_PC ( 0, wd_t, w8_t, w2_t, w0_t);
+  SHA1_STEP (SHA1_F0o, e, a, b, c, d, w0_t);
+  w1_t = SHA1_EXPAND_PC ( 1, we_t, w9_t, w3_t, w1_t);
+  SHA1_STEP (SHA1_F0o, d, e, a, b, c, w1_t);
+  w2_t = SHA1_EXPAND_PC ( 2, wf_t, wa_t, w4_t, w2_t);
+  SHA1_STEP (SHA1_F0o, c, d, e, a, b, w2_t);
+  w3_t = SHA1_EXPAND_PC ( 3, w0_t, wb_t, w5_t, w3_t);
+  SHA1_STEP (SHA1_F0o, b, c, d, e, a, w3_t);
+
+  #undef K
+  #define K SHA1C01
+
+  w4_t = SHA1_EXPAND_PC ( 4, w1_t, wc_t, w6_t, w4_t);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, w4_t);
+  w5_t = SHA1_EXPAND_PC ( 5, w2_t, wd_t, w7_t, w5_t);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, w5_t);
+  w6_t = SHA1_EXPAND_PC ( 6, w3_t, we_t, w8_t, w6_t);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, w6_t);
+  w7_t = SHA1_EXPAND_PC ( 7, w4_t, wf_t, w9_t, w7_t);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, w7_t);
+  w8_t = SHA1_EXPAND_PC ( 8, w5_t, w0_t, wa_t, w8_t);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, w8_t);
+  w9_t = SHA1_EXPAND_PC ( 9, w6_t, w1_t, wb_t, w9_t);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, w9_t);
+  wa_t = SHA1_EXPAND_PC (10, w7_t, w2_t, wc_t, wa_t);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, wa_t);
+  wb_t = SHA1_EXPAND_PC (11, w8_t, w3_t, wd_t, wb_t);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, wb_t);
+  wc_t = SHA1_EXPAND_PC (12, w9_t, w4_t, we_t, wc_t);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, wc_t);
+  wd_t = SHA1_EXPAND_PC (13, wa_t, w5_t, wf_t, wd_t);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, wd_t);
+  we_t = SHA1_EXPAND_PC (14, wb_t, w6_t, w0_t, we_t);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, we_t);
+  wf_t = SHA1_EXPAND_PC (15, wc_t, w7_t, w1_t, wf_t);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, wf_t);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, w0_t);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, w1_t);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, w2_t);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, w3_t);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, w4_t);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, w5_t);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, w6_t);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, w7_t);
+
+  #undef K
+  #define K SHA1C02
+
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  SHA1_STEP (SHA1_F2o, a, b, c, d, e, w8_t);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  SHA1_STEP (SHA1_F2o, e, a, b, c, d, w9_t);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  SHA1_STEP (SHA1_F2o, d, e, a, b, c, wa_t);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  SHA1_STEP (SHA1_F2o, c, d, e, a, b, wb_t);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  SHA1_STEP (SHA1_F2o, b, c, d, e, a, wc_t);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  SHA1_STEP (SHA1_F2o, a, b, c, d, e, wd_t);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  SHA1_STEP (SHA1_F2o, e, a, b, c, d, we_t);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  SHA1_STEP (SHA1_F2o, d, e, a, b, c, wf_t);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  SHA1_STEP (SHA1_F2o, c, d, e, a, b, w0_t);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  SHA1_STEP (SHA1_F2o, b, c, d, e, a, w1_t);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  SHA1_STEP (SHA1_F2o, a, b, c, d, e, w2_t);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  SHA1_STEP (SHA1_F2o, e, a, b, c, d, w3_t);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  SHA1_STEP (SHA1_F2o, d, e, a, b, c, w4_t);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  SHA1_STEP (SHA1_F2o, c, d, e, a, b, w5_t);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  SHA1_STEP (SHA1_F2o, b, c, d, e, a, w6_t);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  SHA1_STEP (SHA1_F2o, a, b, c, d, e, w7_t);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  SHA1_STEP (SHA1_F2o, e, a, b, c, d, w8_t);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  SHA1_STEP (SHA1_F2o, d, e, a, b, c, w9_t);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  SHA1_STEP (SHA1_F2o, c, d, e, a, b, wa_t);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  SHA1_STEP (SHA1_F2o, b, c, d, e, a, wb_t);
+
+  #undef K
+  #define K SHA1C03
+
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, wc_t);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, wd_t);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, we_t);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, wf_t);
+  w0_t = rotl32 ((wd_t ^ w8_t ^ w2_t ^ w0_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, w0_t);
+  w1_t = rotl32 ((we_t ^ w9_t ^ w3_t ^ w1_t), 1u);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, w1_t);
+  w2_t = rotl32 ((wf_t ^ wa_t ^ w4_t ^ w2_t), 1u);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, w2_t);
+  w3_t = rotl32 ((w0_t ^ wb_t ^ w5_t ^ w3_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, w3_t);
+  w4_t = rotl32 ((w1_t ^ wc_t ^ w6_t ^ w4_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, w4_t);
+  w5_t = rotl32 ((w2_t ^ wd_t ^ w7_t ^ w5_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, w5_t);
+  w6_t = rotl32 ((w3_t ^ we_t ^ w8_t ^ w6_t), 1u);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, w6_t);
+  w7_t = rotl32 ((w4_t ^ wf_t ^ w9_t ^ w7_t), 1u);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, w7_t);
+  w8_t = rotl32 ((w5_t ^ w0_t ^ wa_t ^ w8_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, w8_t);
+  w9_t = rotl32 ((w6_t ^ w1_t ^ wb_t ^ w9_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, w9_t);
+  wa_t = rotl32 ((w7_t ^ w2_t ^ wc_t ^ wa_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, wa_t);
+  wb_t = rotl32 ((w8_t ^ w3_t ^ wd_t ^ wb_t), 1u);
+  SHA1_STEP (SHA1_F1, a, b, c, d, e, wb_t);
+  wc_t = rotl32 ((w9_t ^ w4_t ^ we_t ^ wc_t), 1u);
+  SHA1_STEP (SHA1_F1, e, a, b, c, d, wc_t);
+  wd_t = rotl32 ((wa_t ^ w5_t ^ wf_t ^ wd_t), 1u);
+  SHA1_STEP (SHA1_F1, d, e, a, b, c, wd_t);
+  we_t = rotl32 ((wb_t ^ w6_t ^ w0_t ^ we_t), 1u);
+  SHA1_STEP (SHA1_F1, c, d, e, a, b, we_t);
+  wf_t = rotl32 ((wc_t ^ w7_t ^ w1_t ^ wf_t), 1u);
+  SHA1_STEP (SHA1_F1, b, c, d, e, a, wf_t);
+
+  digest[0] += a;
+  digest[1] += b;
+  digest[2] += c;
+  digest[3] += d;
+  digest[4] += e;
+}
 
 inline uint swap_uint(uint val) {
   #ifdef IS_NV
@@ -354,53 +623,87 @@ inline ulong swap_ulong(ulong val)
     #endif  
 }
 
-inline uchar getDifficulty(uchar* hash) {
-  // we push all difficulty levels up to 8 to zero
-  // this increases performance
-  if (hash[0]!=0) { return 0; }
-
-  
-  uchar zerobytes = 1;
-  while (zerobytes < 20 && hash[zerobytes] == 0) {
-    zerobytes++;
+// the number of trailing zero bits of the digest, where the bytes
+// of the big endian digest words are taken in little endian order
+inline uint getDifficulty(const u32 digest[5]) {
+  for (int j=0; j<5; j++) {
+    const u32 w = swap_uint(digest[j]);
+    if (w != 0) { return 32*j + popcount((w & -w) - 1); }
   }
-  uchar zerobits = 0;
-  if (zerobytes < 20) {
-    uchar lastbyte = hash[zerobytes];
-    while (!(lastbyte & 1)) {
-      zerobits++;
-      lastbyte >>= 1;
-    }
+  return 160;
+}
+
+// the shift of the byte at position pos within its 32bit big endian word
+#define BYTE_SHIFT(pos) (8*(3-(pos)%4))
+
+// writes the decimal counters followed by the 0x80 padding byte
+// into the message, which is expected to be in 32bit big endian form and zero there
+inline void setCounter(u32x hashstring[], u64x counter) {
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int i = COUNTER_LENGTH-1; i >= 0; i--) {
+    const int pos = TAIL_LENGTH+i;
+    hashstring[pos/4] |= convert_u32x('0'+counter%10) << BYTE_SHIFT(pos);
+    counter /= 10;
   }
+  hashstring[PADDING_POS/4] |= ((u32)0x80) << BYTE_SHIFT(PADDING_POS);
+}
 
-  return 8 * zerobytes + zerobits;
+// with digit batching, the kernel loop covers all ten values of the last digit
+// and the counters are increased by ten, starting at the second to last digit
+#if DIGIT_BATCH == 10
+#define INCREMENT_DIGIT (COUNTER_LENGTH - 2)
+#else
+#define INCREMENT_DIGIT (COUNTER_LENGTH - 1)
+#endif
+
+// increases the decimal counters in the message, which is expected to be in 32bit big endian form,
+// so that the message never has to be swapped
+// all digit positions are compile time constants, so this works on registers
+// the carry is computed without branching on a single lane, so all lanes
+// stay in lockstep: a digit of '9'+1 yields a carry of one, any other digit zero
+inline void increaseCounter(u32x hashstring[]) {
+  u32x carry = 1;
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int i = INCREMENT_DIGIT; i >= 0; i--) {
+    const int pos = TAIL_LENGTH+i;
+    hashstring[pos/4] += carry << BYTE_SHIFT(pos);
+    carry = (((hashstring[pos/4] >> BYTE_SHIFT(pos)) & 0xff) + (256-('9'+1))) >> 8;
+    hashstring[pos/4] -= (carry*10) << BYTE_SHIFT(pos);
+    if (!ANY_NONZERO(carry)) { break; }
+  }
 }
 
-// increases a decimal string counter
-// counterend should point to the least significant digit of the counter
-inline void increaseStringCounter(char *counterend) {
-  bool add = 1;
-  
-  while (add) {
-    uchar currentdigit = *counterend - '0';
-    add = currentdigit == 9;
-    *counterend = (currentdigit+1)%10 + '0';
-    counterend--;
+#ifdef INTERLEAVED_LAYOUT
+// the decimal digits of the stride by which all counters advance per iteration,
+// the stride is the same for all work items, so they are computed only once
+inline void getStrideDigits(u32 stridedigits[COUNTER_LENGTH], ulong stride) {
+  for (int i = COUNTER_LENGTH-1; i >= 0; i--) {
+    stridedigits[i] = stride%10;
+    stride /= 10;
   }
 }
 
-// increases a decimal string counter
-// counterend should point to the least significant digit of the counter
-inline void increaseStringCounterSwapped(char *str, int endpos) {
-  bool add = 1;
-  
-  while (add) {
-    uchar currentdigit = str[endpos] - '0';
-    add = currentdigit == 9;
-    str[endpos] = (currentdigit+1)%10 + '0';
-    endpos--;
+// adds the stride to the decimal counters in the message, which is expected to be in 32bit big endian form
+// every digit is visited, so all lanes of all work items execute exactly the same instructions
+// the sum of a digit, a stride digit and a carry is at most '9'+10, so the carry is at most one
+// (with digit batching, the last digit of the stride is zero and skipped)
+inline void addToCounter(u32x hashstring[], const u32 stridedigits[COUNTER_LENGTH]) {
+  u32x carry = 0;
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int i = INCREMENT_DIGIT; i >= 0; i--) {
+    const int pos = TAIL_LENGTH+i;
+    hashstring[pos/4] += (carry + stridedigits[i]) << BYTE_SHIFT(pos);
+    carry = (((hashstring[pos/4] >> BYTE_SHIFT(pos)) & 0xff) + (256-('9'+1))) >> 8;
+    hashstring[pos/4] -= (carry*10) << BYTE_SHIFT(pos);
   }
 }
+#endif
 
 inline void compute_targetdigest(u32 targetdigest[5], uchar targetdifficulty) {
   int i=0;
@@ -412,197 +715,701 @@ inline void compute_targetdigest(u32 targetdigest[5], uchar targetdifficulty) {
     targetdigest[i] = 0;
   }
 }
-)"
 
-R"(
-__kernel void TeamSpeakHasher (const ulong startcounter,
-                               const uint iterations,
-                               const uchar targetdifficulty,
-                               const __global uchar* identity,
-                               const uint identity_length,
-                               __global uchar *results)
+// a counter whose hash reaches the target difficulty
+// (this has to match HitRecord in DeviceContext.h)
+typedef struct hit
 {
-  const int gid = get_global_id(0);
-  const uint identity_length_snd_block = identity_length-64;
+  ulong counter;
+  uint  difficulty;
+  // the index of the identity within the batch (0 outside of batches)
+  uint  identity;
+} hit_t;
+
+// on GPUs, the hits and the difficulty histogram are collected per work group in local memory first,
+// whereas on CPUs every work item appends its rare hits to the global buffers directly
+// and counts its histogram privately, such that the CPU kernel needs no barriers
+// the group leader handles the results of its work group, on CPUs every work item is a leader
+#ifdef CPU_KERNEL
+#define RESULT_SPACE    __global
+#define HISTOGRAM_SPACE __private
+#define GROUP_LEADER    1
+#else
+#define RESULT_SPACE    __local
+#define HISTOGRAM_SPACE __local
+#define GROUP_LEADER    (get_local_id(0) == 0)
+#endif
 
-  u32 hashstring[16];
-  
-  for (int i=0; i < 64; i++) {
-    ((uchar*)hashstring)[i] = identity[i];
+// declares the hits and the histogram of the work group within a kernel, the CPU kernel uses
+// the global hit buffers of the kernel arguments hitcount and hits instead
+#ifdef CPU_KERNEL
+#define DECLARE_GROUP_RESULTS                  \
+  __global uint *group_hitcount = hitcount;    \
+  __global hit_t *group_hits = hits;           \
+  uint group_histogram[HISTOGRAM_BINS]
+#else
+#define DECLARE_GROUP_RESULTS                  \
+  __local uint group_hitcount[1];              \
+  __local hit_t group_hits[MAX_HITS];          \
+  __local uint group_histogram[HISTOGRAM_BINS]
+#endif
+
+// clears the results of the work group before any work item of it reports to them
+inline void initGroupResults (RESULT_SPACE uint *group_hitcount, HISTOGRAM_SPACE uint *group_histogram)
+{
+  if (GROUP_LEADER) {
+    // the global hit count of the CPU kernel has been cleared by the host
+    #ifndef CPU_KERNEL
+    *group_hitcount = 0;
+    #endif
+    for (int b=0; b<HISTOGRAM_BINS; b++) { group_histogram[b] = 0; }
   }
+  #ifndef CPU_KERNEL
+  barrier(CLK_LOCAL_MEM_FENCE);
+  #endif
+}
 
-  //we hash the first block 
-  u32 digest1[5];
-  digest1[0] = SHA1M_A;
-  digest1[1] = SHA1M_B;
-  digest1[2] = SHA1M_C;
-  digest1[3] = SHA1M_D;
-  digest1[4] = SHA1M_E;
-  for (int j = 0; j<16; j++) {
-    hashstring[j] = swap_uint(((u32*)hashstring)[j]);
+// appends a hit record to the hits of the work group for every lane whose
+// digest reaches the target, the records beyond MAX_HITS are dropped, but still counted
+// the records are tagged with the index of the identity within the batch (0 outside of batches)
+inline void reportHits (const u32x digest[5], const u64x counter, const u32 targetdigest[5],
+                        RESULT_SPACE uint *hitcount, RESULT_SPACE hit_t *hits, const uint identity)
+{
+  u32 lanedigests[5][VECT_SIZE];
+  u64 lanecounters[VECT_SIZE];
+  for (int j=0; j<5; j++) { STORE_LANES(digest[j], lanedigests[j]); }
+  STORE_LANES(counter, lanecounters);
+
+  for (int l=0; l<VECT_SIZE; l++) {
+    u32 lanedigest[5];
+    for (int j=0; j<5; j++) { lanedigest[j] = lanedigests[j][l]; }
+    if (((lanedigest[0] & targetdigest[0]) |
+         (lanedigest[1] & targetdigest[1]) |
+         (lanedigest[2] & targetdigest[2]) |
+         (lanedigest[3] & targetdigest[3]) |
+         (lanedigest[4] & targetdigest[4])) == 0) {
+      const uint index = atomic_inc(hitcount);
+      if (index < MAX_HITS) {
+        hits[index].counter = lanecounters[l];
+        hits[index].difficulty = getDifficulty(lanedigest);
+        hits[index].identity = identity;
+      }
+    }
   }
-  sha1_64(hashstring, digest1);
+}
 
-  for (int i=0; i<identity_length_snd_block; i++) {
-    ((uchar*)hashstring)[i] = identity[i+64];
+// appends the hits of the work group to the global hit buffer, such that
+// there is at most one global atomic operation per work group
+// this has to be called by all work items of the group
+// (the CPU kernel has already appended its hits to the global buffer)
+inline void flushGroupHits (RESULT_SPACE uint *group_hitcount, RESULT_SPACE hit_t *group_hits,
+                            __global uint *hitcount, __global hit_t *hits)
+{
+  #ifndef CPU_KERNEL
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if (get_local_id(0) == 0 && *group_hitcount > 0) {
+    const uint base = atomic_add(hitcount, *group_hitcount);
+    for (uint i = 0; i < min(*group_hitcount, (uint)MAX_HITS) && base + i < MAX_HITS; i++) {
+      hits[base + i] = group_hits[i];
+    }
   }
+  #endif
+}
+
+// the first byte of the digest, which is zero for a difficulty of 8 or more
+#define HISTOGRAM_BYTE_MASK 0xff000000u
 
-  for (int i=identity_length_snd_block; i<64; i++) {
-    ((uchar*)hashstring)[i] = 0;
+// counts the lanes whose difficulty is at least 8*(b+1) in bin b of the histogram of the work group,
+// which only depends on the first word of the digest
+// (the lanes are only looked at for the rare digests with a zero first byte)
+inline void countDifficulties (const u32x digest0, HISTOGRAM_SPACE uint *histogram)
+{
+  #ifdef DIFFICULTY_HISTOGRAM
+  if (!ANY_ZERO(digest0 & HISTOGRAM_BYTE_MASK)) { return; }
+  u32 lanewords[VECT_SIZE];
+  STORE_LANES(digest0, lanewords);
+  for (int l=0; l<VECT_SIZE; l++) {
+    const u32 w = swap_uint(lanewords[l]);
+    for (int b=0; b<HISTOGRAM_BINS; b++) {
+      if ((w & (u32)((((ulong)1) << (8*(b+1))) - 1)) == 0) {
+        #ifdef CPU_KERNEL
+        histogram[b]++;
+        #else
+        atomic_inc(&histogram[b]);
+        #endif
+      }
+    }
   }
+  #endif
+}
+
+// folds the digest into the checksum of the work item, which proves that it has hashed
+// all of its counters, since the host recomputes it for sampled work items
+inline void foldDigest (const u32x digest[5], u32x *checksum)
+{
+  #ifdef COVERAGE_AUDIT
+  *checksum ^= digest[0] ^ digest[1] ^ digest[2] ^ digest[3] ^ digest[4];
+  #endif
+}
 
-  for (int j = 0; j<identity_length_snd_block/4; j++) {
-    hashstring[j] = swap_uint(hashstring[j]);
+// adds the histogram of the work group to the global one and clears it,
+// the global bins are 64bit counters of two words each (low word first),
+// since not every device has 64bit atomics
+// this must only be called when no work item of the group is hashing (such as after flushGroupHits)
+// (every work item of the CPU kernel flushes its own histogram)
+inline void flushGroupHistogram (HISTOGRAM_SPACE uint *group_histogram, __global uint *histogram)
+{
+  #ifdef DIFFICULTY_HISTOGRAM
+  if (GROUP_LEADER) {
+    for (int b=0; b<HISTOGRAM_BINS; b++) {
+      const uint count = group_histogram[b];
+      if (count > 0 && atomic_add(&histogram[2*b], count) > UINT_MAX - count) {
+        atomic_inc(&histogram[2*b+1]);
+      }
+      group_histogram[b] = 0;
+    }
   }
+  #endif
+}
 
-  ulong currentcounter = startcounter+gid*iterations;
-  u32 digest2[5];
+// a single SHA1 round on the state s, whose schedule word wk already
+// contains the round constant, the round t is a compile time constant
+inline void sha1_round_wk (const int t, u32x s[5], const u32x wk)
+{
+  u32x f;
+  if      (t < 20) { f = SHA1_F0o (s[1], s[2], s[3]); }
+  else if (t < 40) { f = SHA1_F1  (s[1], s[2], s[3]); }
+  else if (t < 60) { f = SHA1_F2o (s[1], s[2], s[3]); }
+  else             { f = SHA1_F1  (s[1], s[2], s[3]); }
+
+  const u32x tmp = rotl32 (s[0], 5u) + f + s[4] + wk;
+  s[4] = s[3];
+  s[3] = s[2];
+  s[2] = rotl32 (s[1], 30u);
+  s[1] = s[0];
+  s[0] = tmp;
+}
 
-  ulong counterlen = countertostring(((uchar*)hashstring)+identity_length_snd_block,
-                                     currentcounter);
-  ((uchar*)hashstring)[identity_length_snd_block+counterlen] = 0x80;
+#define SHA1_K(t) ((t) < 20 ? SHA1C00 : (t) < 40 ? SHA1C01 : (t) < 60 ? SHA1C02 : SHA1C03)
 
-  *((ulong*)(((uchar*)hashstring)+56)) = swap_ulong(8*((ulong)identity_length+counterlen));
+// a single SHA1 round on the state s, the round t is a compile time constant
+inline void sha1_round (const int t, u32x s[5], const u32x x)
+{
+  sha1_round_wk (t, s, x + (u32) SHA1_K (t));
+}
 
-  // we bring the length once to 32bit big endian form
-  hashstring[14] = swap_uint(hashstring[14]);
-  hashstring[15] = swap_uint(hashstring[15]);
+#if SLOW_PHASE && !COUNTER_SPILLS
+// compresses the last block, which only holds the padding and the message length
+// and thus is the same for all counters, its schedule words plus the round
+// constants are precomputed for every counter length
+// (see KernelGenerator::getTrailingSchedule)
+inline void sha1_64_trailing (u32x digest[5])
+{
+  u32x s[5];
+  for (int j=0; j<5; j++) { s[j] = digest[j]; }
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int t = 0; t < 80; t++) { sha1_round_wk (t, s, trailing_schedule[t]); }
+  for (int j=0; j<5; j++) { digest[j] += s[j]; }
+}
+#endif
 
-  const int swapendianness_start = identity_length_snd_block/4;
+#if DIGIT_BATCH == 10
+// the last digit of the counter is the only byte in which the ten counters of a decade differ
+#define LAST_DIGIT_WORD ((PADDING_POS - 1) / 4)
 
-  u32 targetdigest[5];
-  compute_targetdigest(targetdigest, targetdifficulty);
-  //we swap it now, to avoid swapping in the loop
-  for (int j=0; j<5; j++) { targetdigest[j] = swap_uint(targetdigest[j]); }
+// whether the ten counters of a decade share the rounds before the last digit,
+// the kernel variant without it hashes them one after the other and needs
+// fewer registers (see TunedParameters)
+#ifndef DECADE_DELTAS
+#define DECADE_DELTAS 1
+#endif
 
-  bool target_found = false;
+#if COUNTER_SPILLS || !DECADE_DELTAS
+// hashes the ten counters of the current decade one after the other, the last digit of the counters
+// in the message is expected to be '0', which belongs to the given counter
+// if the last digit is located in the second block, both blocks are hashed for every digit
+inline void hashDecade (u32x hashstring[], const u64x counter, const u32 digest1[5],
+                        const u32 pc_state[5], const u32 pc_expansion[16],
+                        const u32 targetdigest[5],
+                        RESULT_SPACE uint *hitcount, RESULT_SPACE hit_t *hits, const uint identity,
+                        HISTOGRAM_SPACE uint *histogram, u32x *checksum)
+{
+  for (int d = 0; d < 10; d++) {
+    u32x block[MESSAGE_WORDS];
+    for (int j=0; j<MESSAGE_WORDS; j++) { block[j] = hashstring[j]; }
+    block[LAST_DIGIT_WORD] |= ((u32)d) << BYTE_SHIFT(PADDING_POS - 1);
 
-  for (ulong it = 0; it<iterations; it++) {
+    u32x digest2[5];
     for (int j=0; j<5; j++) { digest2[j] = digest1[j]; }
-
-    for (int j = swapendianness_start; j<14; j++) {
-      hashstring[j] = swap_uint(hashstring[j]);
+    sha1_64_precomputed(block, digest2, pc_state, pc_expansion);
+    #if COUNTER_SPILLS
+    sha1_64(block + 16, digest2);
+    #elif SLOW_PHASE
+    sha1_64_trailing(digest2);
+    #endif
+
+    countDifficulties(digest2[0], histogram);
+    foldDigest(digest2, checksum);
+    // we only consider security levels 32 or larger
+    // (this gives us a slight performance boost)
+    if (ANY_ZERO(digest2[0])) {
+      reportHits(digest2, counter+d, targetdigest, hitcount, hits, identity);
     }
+  }
+}
+#else
 
-    
-    sha1_64(hashstring, digest2);
+// hashes the ten counters of the current decade, the last digit of the counters
+// in the message is expected to be '0', which belongs to the given counter
+// the message expansion is linear, so the schedule of the counter with last digit d
+// is the schedule of the message XOR the expanded difference d of the last digit,
+// which is precomputed for every counter length (see KernelGenerator::getDecadeDeltas)
+// the rounds before the word of the last digit are shared by all ten counters
+inline void hashDecade (u32x hashstring[], const u64x counter, const u32 digest1[5],
+                        const u32 pc_state[5], const u32 pc_expansion[16],
+                        const u32 targetdigest[5],
+                        RESULT_SPACE uint *hitcount, RESULT_SPACE hit_t *hits, const uint identity,
+                        HISTOGRAM_SPACE uint *histogram, u32x *checksum)
+{
+  u32x w[80];
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int t = 0; t < 16; t++) { w[t] = hashstring[t]; }
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int i = 0; i < 16; i++) {
+    w[16+i] = rotl32 (SHA1_TERM_PC (i+13, w[i+13]) ^
+                      SHA1_TERM_PC (i+ 8, w[i+ 8]) ^
+                      SHA1_TERM_PC (i+ 2, w[i+ 2]) ^
+                      SHA1_TERM_PC (i   , w[i   ]) ^
+                      ((i < CONST_WORDS) ? pc_expansion[i] : 0), 1u);
+  }
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int t = 32; t < 80; t++) { w[t] = rotl32 (w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16], 1u); }
+
+  // the precomputed state is in the order of the unrolled rounds
+  // of sha1_64_precomputed, we bring it back to a, b, c, d, e
+  u32x shared[5];
+  for (int j=0; j<5; j++) { shared[j] = pc_state[(j + 5 - CONST_WORDS % 5) % 5]; }
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int t = CONST_WORDS; t < LAST_DIGIT_WORD; t++) { sha1_round (t, shared, w[t]); }
+
+  // CPU compilers already vectorize across the lanes and work items, and unrolling
+  // the ten digits as well would only overflow the instruction cache
+  #if defined(_unroll) && !defined(CPU_KERNEL)
+  #pragma unroll
+  #endif
+  for (int d = 0; d < 10; d++) {
+    u32x s[5];
+    for (int j=0; j<5; j++) { s[j] = shared[j]; }
+    #ifdef _unroll
+    #pragma unroll
+    #endif
+    for (int t = LAST_DIGIT_WORD; t < 80; t++) { sha1_round (t, s, w[t] ^ decade_deltas[d][t]); }
+
+    u32x digest2[5];
+    for (int j=0; j<5; j++) { digest2[j] = digest1[j] + s[j]; }
+    #if SLOW_PHASE
+    sha1_64_trailing(digest2);
+    #endif
+
+    countDifficulties(digest2[0], histogram);
+    foldDigest(digest2, checksum);
     // we only consider security levels 32 or larger
     // (this gives us a slight performance boost)
-    if (digest2[0] == 0) {
-      target_found |= 0 == ((digest2[0] & targetdigest[0]) |
-                            (digest2[1] & targetdigest[1]) |
-                            (digest2[2] & targetdigest[2]) |
-                            (digest2[3] & targetdigest[3]) |
-                            (digest2[4] & targetdigest[4]));
+    if (ANY_ZERO(digest2[0])) {
+      reportHits(digest2, counter+d, targetdigest, hitcount, hits, identity);
     }
+  }
+}
+#endif
+#endif
+)"
 
-    //we swap the endianness back to be able to increase the counter
-    for (int j = swapendianness_start; j<14; j++) {
-      hashstring[j] = swap_uint(hashstring[j]);
-    }
+R"(
+// every work item hashes CHAINS independent sets of VECT_SIZE counters, such that the
+// compiler can interleave their rounds, and the loop over the iterations is unrolled
+// ITERATION_UNROLL times, both are kernel variants (see TunedParameters)
+#ifndef CHAINS
+#define CHAINS 1
+#endif
+#ifndef ITERATION_UNROLL
+#define ITERATION_UNROLL 1
+#endif
+
+#define PRAGMA(x) _Pragma(#x)
+#define UNROLL_BY(n) PRAGMA(unroll n)
+
+// the first counters of the lanes of work item item, when items work items
+// share a range of items*VECT_SIZE*iterations*DIGIT_BATCH counters
+inline u64x firstCounters (const ulong rangestart, const ulong item, const uint iterations)
+{
+  #ifdef INTERLEAVED_LAYOUT
+  // the lanes hash neighbouring counters and all of them advance by the same stride,
+  // so the carries of all lanes happen in the same iterations
+  return rangestart+(item*VECT_SIZE+LANE_IDS)*DIGIT_BATCH;
+  #else
+  // every lane starts at its own range of iterations*DIGIT_BATCH counters
+  return rangestart+(item*VECT_SIZE+LANE_IDS)*iterations*DIGIT_BATCH;
+  #endif
+}
+
+// hashes the counters of work item item out of items work items,
+// which share the range of counters starting at rangestart (see firstCounters)
+// every chain of the work item acts as a work item of its own
+// the abort word is polled every ABORT_POLL_ITERATIONS iterations (unless it is null),
+// the returned number of iterations has been hashed completely
+// the checksum of all digests is only complete if all iterations have been hashed
+inline uint hashRange (const ulong rangestart, const ulong item, const ulong items,
+                       const uint iterations,
+                       __constant u32* identitystate,
+                       const u32 targetdigest[5],
+                       RESULT_SPACE uint *hitcount, RESULT_SPACE hit_t *hits, const uint identity,
+                       HISTOGRAM_SPACE uint *histogram, u32 *checksum,
+                       volatile __global uint *abortword)
+{
+  // the complete blocks of the identity are the same for all counters,
+  // their midstate has been computed on the host
+  u32 digest1[5];
+  for (int j=0; j<5; j++) { digest1[j] = identitystate[IDENTITYSTATE_MIDSTATE+j]; }
+
+  // the state after the constant rounds of the (first) tail block
+  u32 pc_state[5];
+  u32 pc_expansion[16];
+  for (int j=0; j<5; j++) { pc_state[j] = identitystate[IDENTITYSTATE_PC_STATE+j]; }
+  for (int j=0; j<16; j++) { pc_expansion[j] = identitystate[IDENTITYSTATE_PC_EXPANSION+j]; }
+
+  // the tail of the identity comes in 32bit big endian form,
+  // the counter is inserted and increased in that form as well
+  // note that in the slow phase, the second block usually only holds the padding and the length,
+  // so it is hashed from its precomputed schedule (see sha1_64_trailing),
+  // unless the counter spills into it
+  u32x hashstring[CHAINS][MESSAGE_WORDS];
+  u64x currentcounter[CHAINS];
+  #ifdef _unroll
+  #pragma unroll
+  #endif
+  for (int c=0; c<CHAINS; c++) {
+    #ifdef _unroll
+    #pragma unroll
+    #endif
+    for (int j=0; j<16; j++) { hashstring[c][j] = identitystate[IDENTITYSTATE_TAIL+j]; }
+    #ifdef _unroll
+    #pragma unroll
+    #endif
+    for (int j=16; j<MESSAGE_WORDS; j++) { hashstring[c][j] = 0; }
+
+    currentcounter[c] = firstCounters(rangestart, item*CHAINS+c, iterations);
+    setCounter(hashstring[c], currentcounter[c]);
+    #if !SLOW_PHASE || COUNTER_SPILLS
+    hashstring[c][LENGTH_WORD_HI] = 0;
+    hashstring[c][LENGTH_WORD_LO] = MESSAGE_BITS;
+    #endif
+  }
 
-    increaseStringCounter(((uchar*)hashstring)+identity_length_snd_block+counterlen-1);
+  #ifdef INTERLEAVED_LAYOUT
+  const ulong stride = items*CHAINS*VECT_SIZE*DIGIT_BATCH;
+  u32 stridedigits[COUNTER_LENGTH];
+  getStrideDigits(stridedigits, stride);
+  #else
+  const ulong stride = DIGIT_BATCH;
+  #endif
+
+  u32x digest2[5];
+  u32x rangechecksum = 0;
+  *checksum = 0;
+
+  #if ITERATION_UNROLL > 1
+  UNROLL_BY(ITERATION_UNROLL)
+  #endif
+  for (ulong it = 0; it<iterations; it++) {
+    if (abortword != 0 && it % ABORT_POLL_ITERATIONS == 0 && *abortword != 0) { return (uint)it; }
+
+    #ifdef _unroll
+    #pragma unroll
+    #endif
+    for (int c=0; c<CHAINS; c++) {
+      #if DIGIT_BATCH == 10
+      hashDecade(hashstring[c], currentcounter[c]+it*stride, digest1, pc_state, pc_expansion, targetdigest, hitcount, hits, identity, histogram, &rangechecksum);
+      #else
+      for (int j=0; j<5; j++) { digest2[j] = digest1[j]; }
+
+      sha1_64_precomputed(hashstring[c], digest2, pc_state, pc_expansion);
+      #if COUNTER_SPILLS
+      sha1_64(hashstring[c] + 16, digest2);
+      #elif SLOW_PHASE
+      sha1_64_trailing(digest2);
+      #endif
+
+      countDifficulties(digest2[0], histogram);
+      foldDigest(digest2, &rangechecksum);
+      // we only consider security levels 32 or larger
+      // (this gives us a slight performance boost)
+      if (ANY_ZERO(digest2[0])) {
+        reportHits(digest2, currentcounter[c]+it*stride, targetdigest, hitcount, hits, identity);
+      }
+      #endif
+
+      #ifdef INTERLEAVED_LAYOUT
+      addToCounter(hashstring[c], stridedigits);
+      #else
+      increaseCounter(hashstring[c]);
+      #endif
+    }
   }
-  results[gid] = target_found;
+
+  #ifdef COVERAGE_AUDIT
+  u32 lanechecksums[VECT_SIZE];
+  STORE_LANES(rangechecksum, lanechecksums);
+  for (int l=0; l<VECT_SIZE; l++) { *checksum ^= lanechecksums[l]; }
+  #endif
+  return iterations;
+}
+
+// the target in the byte order of the digests
+inline void getTargetDigest(u32 targetdigest[5], const uchar targetdifficulty) {
+  compute_targetdigest(targetdigest, targetdifficulty);
+  // we swap it now, to avoid swapping in the loop
+  for (int j=0; j<5; j++) { targetdigest[j] = swap_uint(targetdigest[j]); }
+}
+
+// the body of TeamSpeakHasher and TeamSpeakHasher2, the local memory for the results
+// of the work group has to be declared by the kernel
+inline void hashKernelRange (const ulong startcounter,
+                             const uint iterations,
+                             const uchar targetdifficulty,
+                             __constant u32* identitystate,
+                             __global uint *hitcount,
+                             __global hit_t *hits,
+                             volatile __global uint *abortword,
+                             __global uint *progress,
+                             __global uint *histogram,
+                             __global uint *checksums,
+                             RESULT_SPACE uint *group_hitcount,
+                             RESULT_SPACE hit_t *group_hits,
+                             HISTOGRAM_SPACE uint *group_histogram)
+{
+  initGroupResults(group_hitcount, group_histogram);
+
+  u32 targetdigest[5];
+  getTargetDigest(targetdigest, targetdifficulty);
+
+  u32 checksum;
+  const uint done = hashRange(startcounter, get_global_id(0), get_global_size(0), iterations,
+                              identitystate, targetdigest, group_hitcount, group_hits, 0, group_histogram,
+                              &checksum, abortword);
+  // the host only reads the progress after an abort, until then it stays at its initial value
+  if (done < iterations) { progress[get_global_id(0)] = done; }
+  #ifdef COVERAGE_AUDIT
+  // the tune kernels are not audited, so they pass no checksum buffer
+  if (checksums != 0) { checksums[get_global_id(0)] = checksum; }
+  #endif
+
+  flushGroupHits(group_hitcount, group_hits, hitcount, hits);
+  flushGroupHistogram(group_histogram, histogram);
+}
+)"
+
+R"(
+#if !SLOW_PHASE
+__kernel void TeamSpeakHasher (const ulong startcounter,
+                               const uint iterations,
+                               const uchar targetdifficulty,
+                               __constant u32* identitystate,
+                               __global uint *hitcount,
+                               __global hit_t *hits,
+                               volatile __global uint *abortword,
+                               __global uint *progress,
+                               __global uint *histogram,
+                               __global uint *checksums)
+{
+  // the hits and the difficulty histogram are collected per work group first
+  DECLARE_GROUP_RESULTS;
+  hashKernelRange(startcounter, iterations, targetdifficulty, identitystate, hitcount, hits,
+                  abortword, progress, histogram, checksums, group_hitcount, group_hits, group_histogram);
 }
+#endif
 )"
 
 
 R"(
+#if SLOW_PHASE
 __kernel void TeamSpeakHasher2 (const ulong startcounter,
                                 const uint iterations,
                                 const uchar targetdifficulty,
-                                const __global uchar* identity,
-                                const uint identity_length,
-                                __global uchar *results)
+                                __constant u32* identitystate,
+                                __global uint *hitcount,
+                                __global hit_t *hits,
+                                volatile __global uint *abortword,
+                                __global uint *progress,
+                                __global uint *histogram,
+                                __global uint *checksums)
 {
-  const int gid = get_global_id(0);
-  const uint identity_length_snd_block = identity_length-64;
+  // the hits and the difficulty histogram are collected per work group first
+  DECLARE_GROUP_RESULTS;
+  hashKernelRange(startcounter, iterations, targetdifficulty, identitystate, hitcount, hits,
+                  abortword, progress, histogram, checksums, group_hitcount, group_hits, group_histogram);
+}
+#endif
+)"
 
-  u32 hashstring[32];
-  
-  for (int i=0; i<64; i++) {
-    ((uchar*)hashstring)[i] = identity[i];
-  }
 
-  // we hash the first block 
-  u32 digest1[5];
-  digest1[0] = SHA1M_A;
-  digest1[1] = SHA1M_B;
-  digest1[2] = SHA1M_C;
-  digest1[3] = SHA1M_D;
-  digest1[4] = SHA1M_E;
-  for (int j = 0; j<16; j++) {
-    hashstring[j] = swap_uint(((u32*)hashstring)[j]);
-  }
-  sha1_64(hashstring, digest1);
+R"(
+#ifdef PERSISTENT_KERNEL
+// the work queue of the persistent kernel, which the host writes before every launch
+// the host publishes leases of leasechunks chunks each, every chunk is hashed by one work group
+// (this has to match WorkQueue in DeviceContext.h)
+typedef struct workqueue
+{
+  uint  published;
+  uint  reserved;
+  ulong leasestart[MAX_LEASES];
+} workqueue_t;
 
-  for (int i=0; i<identity_length_snd_block; i++) {
-    ((uchar*)hashstring)[i] = identity[i+64];
-  }
+#define NO_CHUNK 0xffffffffu
 
-  for (int i=identity_length_snd_block; i<128; i++) {
-    ((uchar*)hashstring)[i] = 0;
-  }
-   
-  for (int j = 0; j<identity_length_snd_block/4; j++) {
-    hashstring[j] = swap_uint(hashstring[j]);
+// claims the next chunk, the claim only succeeds if the chunk belongs to a published lease
+// and the kernel has not been aborted
+inline uint claimChunk (volatile __global uint *cursor, __global const workqueue_t *queue,
+                        const uint leasechunks, volatile __global uint *abortword)
+{
+  for (;;) {
+    if (*abortword != 0) { return NO_CHUNK; }
+    const uint chunk = *cursor;
+    if (chunk >= queue->published*leasechunks) { return NO_CHUNK; }
+    if (atomic_cmpxchg(cursor, chunk, chunk+1) == chunk) { return chunk; }
   }
+}
 
-  ulong currentcounter = startcounter+gid*iterations;
-  u32 digest2[5];
-
-  ulong counterlen = countertostring(((uchar*)hashstring)+identity_length_snd_block,
-                                     currentcounter);
-  ((uchar*)hashstring)[identity_length_snd_block+counterlen] = 0x80;
-
-  *((ulong*)(((uchar*)hashstring)+64+56)) = swap_ulong(8*((ulong)identity_length+counterlen));
-
-  // we bring the first word of the second block to 32bit big endian form
-  // note that this can only be a zero word, or 0x80,0x00,0x00,0x00
-  hashstring[16] = swap_uint(hashstring[16]);
-
-  // we bring the length once to 32bit big endian form
-  hashstring[16+14] = swap_uint(hashstring[16+14]);
-  hashstring[16+15] = swap_uint(hashstring[16+15]);
+// the grid of this kernel is sized to the compute units, its work groups hash chunks
+// until the published leases are exhausted or the host aborts them
+__kernel void TeamSpeakHasherPersistent (const uint chunkiterations,
+                                         const uint leasechunks,
+                                         const uchar targetdifficulty,
+                                         __constant u32* identitystate,
+                                         volatile __global uint *cursor,
+                                         __global const workqueue_t *queue,
+                                         volatile __global uint *abortword,
+                                         __global uint *hitcount,
+                                         __global hit_t *hits,
+                                         __global uint *histogram)
+{
+  // the hits and the difficulty histogram are collected per work group first
+  DECLARE_GROUP_RESULTS;
+  initGroupResults(group_hitcount, group_histogram);
 
-  const int swapendianness_start = identity_length_snd_block/4;
   u32 targetdigest[5];
-  compute_targetdigest(targetdigest, targetdifficulty);
-  // we swap it now, to avoid swapping in the loop
-  for (int j=0; j<5; j++) { targetdigest[j] = swap_uint(targetdigest[j]); }
+  getTargetDigest(targetdigest, targetdifficulty);
 
-  bool target_found = false;
+  // on CPUs, every work item claims chunks of its own, the host runs the CPU kernel
+  // with a local work size of 1, such that the chunks have the same size
+  #ifdef CPU_KERNEL
+  const ulong chunkitems = 1;
+  const ulong chunkitem = 0;
+  #else
+  __local uint group_chunk;
+  const ulong chunkitems = get_local_size(0);
+  const ulong chunkitem = get_local_id(0);
+  #endif
+  const ulong chunkcounters = chunkitems*CHAINS*VECT_SIZE*chunkiterations*DIGIT_BATCH;
 
-  for (ulong it = 0; it<iterations; it++) {
-    for (int j=0; j<5; j++) { digest2[j] = digest1[j]; }
+  for (;;) {
+    #ifdef CPU_KERNEL
+    const uint chunk = claimChunk(cursor, queue, leasechunks, abortword);
+    flushGroupHistogram(group_histogram, histogram);
+    #else
+    if (get_local_id(0) == 0) { group_chunk = claimChunk(cursor, queue, leasechunks, abortword); }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    const uint chunk = group_chunk;
+    // the kernel hashes many chunks, so the histogram of the work group is flushed
+    // after every chunk, before it could overflow
+    flushGroupHistogram(group_histogram, histogram);
+    // the next claim must not overwrite the chunk before all work items have read it
+    barrier(CLK_LOCAL_MEM_FENCE);
+    #endif
+    if (chunk == NO_CHUNK) { break; }
+
+    const ulong chunkstart = queue->leasestart[chunk/leasechunks] + (chunk%leasechunks)*chunkcounters;
+    // the chunks are only aborted between chunks, such that the claimed chunks are complete
+    // the chunks are claimed dynamically, so they are not audited
+    u32 checksum;
+    hashRange(chunkstart, chunkitem, chunkitems, chunkiterations,
+              identitystate, targetdigest, group_hitcount, group_hits, 0, group_histogram, &checksum, 0);
+  }
 
-    for (int j = swapendianness_start; j<16; j++) {
-      hashstring[j] = swap_uint(hashstring[j]);
-    }
+  flushGroupHits(group_hitcount, group_hits, hitcount, hits);
+}
+#endif
+)"
 
-    sha1_64(hashstring, digest2);
-    sha1_64(((u32*)hashstring)+16, digest2);
+R"(
+#ifdef IDENTITY_BATCH
+// an identity of a batch, which owns the work groups from firstgroup up to the first group
+// of the next entry, the first items of its work items hash the given number of iterations
+// (this has to match BatchEntry in DeviceContext.h)
+typedef struct batchentry
+{
+  ulong startcounter;
+  uint  firstgroup;
+  uint  items;
+  uint  iterations;
+  uint  targetdifficulty;
+  // the index of the identity within the batch
+  uint  identity;
+  uint  reserved;
+} batchentry_t;
+
+// hashes several identities of the same length within one grid, every one of them
+// has its own range of counters and its own target, the entries are ordered by
+// their first work group and the identity states follow each other in identitystates
+__kernel void TeamSpeakHasherBatch (const uint entries,
+                                    __constant batchentry_t *batch,
+                                    __constant u32* identitystates,
+                                    __global uint *hitcount,
+                                    __global hit_t *hits,
+                                    volatile __global uint *abortword,
+                                    __global uint *progress,
+                                    __global uint *histogram,
+                                    __global uint *checksums)
+{
+  // the hits and the difficulty histogram are collected per work group first
+  DECLARE_GROUP_RESULTS;
+  initGroupResults(group_hitcount, group_histogram);
 
-    // we only consider security levels 32 or larger
-    // (this gives us a slight performance boost)
-    if (digest2[0]==0) {
-      target_found |= 0 == ((digest2[0] & targetdigest[0]) |
-                            (digest2[1] & targetdigest[1]) |
-                            (digest2[2] & targetdigest[2]) |
-                            (digest2[3] & targetdigest[3]) |
-                            (digest2[4] & targetdigest[4]));
-    }
+  uint e = 0;
+  for (uint i = 1; i < entries; i++) {
+    if (get_group_id(0) >= batch[i].firstgroup) { e = i; }
+  }
+  // the work items beyond the items of the entry only take part in the barriers
+  const ulong item = get_global_id(0) - (ulong)batch[e].firstgroup*get_local_size(0);
+  const uint iterations = (item < batch[e].items) ? batch[e].iterations : 0;
 
-    // we swap the endianness back to be able to increase the counter
-    for (int j = swapendianness_start; j<16; j++) {
-      hashstring[j] = swap_uint(hashstring[j]);
-    }
+  u32 targetdigest[5];
+  getTargetDigest(targetdigest, (uchar)batch[e].targetdifficulty);
+
+  u32 checksum;
+  const uint done = hashRange(batch[e].startcounter, item, batch[e].items, iterations,
+                              identitystates + batch[e].identity*IDENTITYSTATE_WORDS, targetdigest,
+                              group_hitcount, group_hits, batch[e].identity, group_histogram, &checksum, abortword);
+  // the host only reads the progress after an abort, until then it stays at its initial value
+  if (done < iterations) { progress[get_global_id(0)] = done; }
+  #ifdef COVERAGE_AUDIT
+  // as with the range kernels, the checksums are only written if a buffer is passed
+  if (checksums != 0) { checksums[get_global_id(0)] = checksum; }
+  #endif
 
-    increaseStringCounter(((uchar*)hashstring)+identity_length_snd_block+counterlen-1);
-  }
-  results[gid] = target_found;
+  flushGroupHits(group_hitcount, group_hits, hitcount, hits);
+  flushGroupHistogram(group_histogram, histogram);
 }
+#endif
 )";
 
 #endif
@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "KernelGenerator.h"
+
+#include <cstdint>
+
+#include <future>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include <CL/cl.hpp>
+
+#include "TSUtil.h"
+
+const char* KernelGenerator::KERNEL_NAME = "TeamSpeakHasher";
+const char* KernelGenerator::KERNEL_NAME2 = "TeamSpeakHasher2";
+const char* KernelGenerator::KERNEL_NAME_PERSISTENT = "TeamSpeakHasherPersistent";
+const char* KernelGenerator::KERNEL_NAME_BATCH = "TeamSpeakHasherBatch";
+
+static uint32_t rol(const uint32_t value, const size_t bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+KernelGenerator::KernelGenerator() :
+  kernel_code(nullptr),
+  identity_length(0),
+  persistent(false)
+{}
+
+KernelGenerator::KernelGenerator(cl::Context context,
+  cl::Device device,
+  const char* kernel_code,
+  std::string build_opts,
+  size_t identity_length,
+  bool persistent) :
+  context(context),
+  device(device),
+  kernel_code(kernel_code),
+  build_opts(std::move(build_opts)),
+  identity_length(identity_length),
+  persistent(persistent)
+{}
+
+std::string KernelGenerator::getBuildOptions(size_t identity_length, uint8_t counterlength) {
+  return " -D IDENTITY_LENGTH=" + std::to_string(identity_length)
+    + " -D COUNTER_LENGTH=" + std::to_string(counterlength);
+}
+
+std::string KernelGenerator::getDecadeDeltas(size_t identity_length, uint8_t counterlength) {
+  // the byte position of the last digit after the complete blocks of the public key
+  // (if it is in the second block, the deltas are not used, see hashDecade in Kernel.h)
+  const size_t lastdigit_pos = TSUtil::getTailLength(identity_length) + counterlength - 1;
+
+  std::ostringstream out;
+  out << "__constant uint decade_deltas[10][80] = {" << std::endl;
+  for (uint32_t digit = 0; digit < 10; digit++) {
+    // '0' + digit == '0' ^ digit, so the message differs only by the digit itself
+    uint32_t w[80] = { 0 };
+    w[lastdigit_pos / 4] = digit << (8 * (3 - lastdigit_pos % 4));
+    for (size_t t = 16; t < 80; t++) {
+      w[t] = rol(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+    }
+
+    out << "  {";
+    for (size_t t = 0; t < 80; t++) {
+      out << (t > 0 ? "," : "") << w[t] << "u";
+    }
+    out << "}," << std::endl;
+  }
+  out << "};" << std::endl;
+  return out.str();
+}
+
+std::string KernelGenerator::getTrailingSchedule(size_t identity_length, uint8_t counterlength) {
+  if (!TSUtil::isSlowPhaseLength(identity_length, counterlength)
+    || TSUtil::countersSpill(identity_length, counterlength)) {
+    return "";
+  }
+
+  const uint64_t message_length = identity_length + counterlength;
+  const uint64_t block_start = ((message_length + 8) / 64) * 64;
+
+  uint32_t w[80] = { 0 };
+  if (message_length >= block_start) {
+    // the counter fills the previous block up to its last byte
+    const size_t padding_pos = message_length - block_start;
+    w[padding_pos / 4] = 0x80u << (8 * (3 - padding_pos % 4));
+  }
+  w[14] = static_cast<uint32_t>((8 * message_length) >> 32);
+  w[15] = static_cast<uint32_t>(8 * message_length);
+  for (size_t t = 16; t < 80; t++) {
+    w[t] = rol(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+  }
+
+  const uint32_t k[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+  std::ostringstream out;
+  out << "__constant uint trailing_schedule[80] = {";
+  for (size_t t = 0; t < 80; t++) {
+    out << (t > 0 ? "," : "") << static_cast<uint32_t>(w[t] + k[t / 20]) << "u";
+  }
+  out << "};" << std::endl;
+  return out.str();
+}
+
+std::string KernelGenerator::getSource(const char* kernel_code, size_t identity_length, uint8_t counterlength) {
+  return getDecadeDeltas(identity_length, counterlength)
+    + getTrailingSchedule(identity_length, counterlength)
+    + kernel_code;
+}
+
+void KernelGenerator::prepare(uint8_t counterlength) {
+  if (counterlength > 20 || programs.find(counterlength) != programs.end()) {
+    return;
+  }
+
+  const std::string opts = build_opts + getBuildOptions(identity_length, counterlength);
+  const std::string source = getSource(kernel_code, identity_length, counterlength);
+  // the copies make sure that the build does not depend on this object,
+  // which may be moved around while the build is running
+  cl::Context ctx = context;
+  cl::Device dev = device;
+  programs[counterlength] = std::async(std::launch::async, [ctx, dev, source, opts]() -> cl::Program {
+    cl::Program::Sources sources;
+    sources.push_back({ source.c_str(), source.size() });
+    cl::Program program(ctx, sources);
+    program.build({ dev }, opts.c_str());
+    return program;
+  }).share();
+}
+
+cl::Kernel KernelGenerator::getKernel(uint8_t counterlength) {
+  if (!persistent) {
+    return getRangeKernel(counterlength);
+  }
+  return getKernel(counterlength, KERNEL_NAME_PERSISTENT, persistentkernels);
+}
+
+cl::Kernel KernelGenerator::getRangeKernel(uint8_t counterlength) {
+  const char* name = TSUtil::isSlowPhaseLength(identity_length, counterlength) ? KERNEL_NAME2 : KERNEL_NAME;
+  return getKernel(counterlength, name, kernels);
+}
+
+cl::Kernel KernelGenerator::getBatchKernel(uint8_t counterlength) {
+  return getKernel(counterlength, KERNEL_NAME_BATCH, batchkernels);
+}
+
+cl::Kernel KernelGenerator::getKernel(uint8_t counterlength, const char* name, std::map<uint8_t, cl::Kernel>& cache) {
+  auto kernel = cache.find(counterlength);
+  if (kernel != cache.end()) {
+    return kernel->second;
+  }
+
+  prepare(counterlength);
+  cl::Program program = programs[counterlength].get();
+  if (program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) != CL_BUILD_SUCCESS) {
+    std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+    exit(1);
+  }
+
+  cl::Kernel newkernel(program, name);
+  cache[counterlength] = newkernel;
+
+  // we already build the program for the next counter length,
+  // such that switching to it does not stall the device
+  prepare(counterlength + 1);
+
+  return newkernel;
+}
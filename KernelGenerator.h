@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef KERNELGENERATOR_H_
+#define KERNELGENERATOR_H_
+
+#include <cstdint>
+
+#include <future>
+#include <map>
+#include <string>
+
+#include <CL/cl.hpp>
+
+// Builds the kernel programs of one device, each specialized for the identity
+// and for one decimal length of the counter, such that the message layout is
+// known at compile time.
+// Programs are cached, and the program for the next counter length is built
+// in the background as soon as the current one is used.
+class KernelGenerator {
+public:
+  KernelGenerator();
+  KernelGenerator(cl::Context context,
+    cl::Device device,
+    const char* kernel_code,
+    std::string build_opts,
+    size_t identity_length,
+    bool persistent);
+
+  // returns the kernel for counters with the given decimal length
+  // (this only blocks if the program has not been built in advance)
+  cl::Kernel getKernel(uint8_t counterlength);
+
+  // returns the kernel that hashes a single range of counters with the given decimal length,
+  // which is the same as getKernel unless the device runs the persistent kernel
+  // (then it is only used for the last counters before the next length, see TSHasherContext::launchRange)
+  cl::Kernel getRangeKernel(uint8_t counterlength);
+
+  // returns the kernel that hashes several identities of the same length at once,
+  // which is only available if the programs are built with IDENTITY_BATCH
+  cl::Kernel getBatchKernel(uint8_t counterlength);
+
+  // starts building the program for the given counter length in the background
+  void prepare(uint8_t counterlength);
+
+  static std::string getBuildOptions(size_t identity_length, uint8_t counterlength);
+
+  // returns the program source for the given counter length, which consists of
+  // the generated constants followed by the kernel code
+  static std::string getSource(const char* kernel_code, size_t identity_length, uint8_t counterlength);
+
+  static const char* KERNEL_NAME;
+  static const char* KERNEL_NAME2;
+  static const char* KERNEL_NAME_PERSISTENT;
+  static const char* KERNEL_NAME_BATCH;
+
+private:
+  // the expanded message differences between the counter ending in '0'
+  // and the counters ending in '0'-'9' (see hashDecade in Kernel.h)
+  static std::string getDecadeDeltas(size_t identity_length, uint8_t counterlength);
+
+  // the schedule words plus the round constants of the last block in the slow phase,
+  // which only holds the padding and the message length (see sha1_64_trailing in Kernel.h)
+  static std::string getTrailingSchedule(size_t identity_length, uint8_t counterlength);
+
+  cl::Kernel getKernel(uint8_t counterlength, const char* name, std::map<uint8_t, cl::Kernel>& cache);
+
+  cl::Context context;
+  cl::Device device;
+  const char* kernel_code;
+  std::string build_opts;
+  size_t identity_length;
+  // whether the persistent kernel is used instead of the kernels of the two phases
+  bool persistent;
+
+  std::map<uint8_t, std::shared_future<cl::Program>> programs;
+  std::map<uint8_t, cl::Kernel> kernels;
+  std::map<uint8_t, cl::Kernel> persistentkernels;
+  std::map<uint8_t, cl::Kernel> batchkernels;
+};
+
+#endif
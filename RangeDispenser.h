@@ -0,0 +1,175 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RANGEDISPENSER_H_
+#define RANGEDISPENSER_H_
+
+#include <cstdint>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "TSUtil.h"
+
+// hands out disjoint ranges of counters to the devices and the threads of the native engine
+// without taking a lock, a range never crosses an increase of the decimal length of the counters,
+// since the kernels are specialized for it, and starts at a multiple of the alignment,
+// since the work items of the kernels start at a multiple of the digit batch
+// ranges that are given back, because a stopped kernel has not hashed them, are handed out
+// again before any other counters, only then a lock is taken
+// every taker has a holder, which keeps the first counter of the ranges it has not finished yet,
+// such that the progress saved never skips a range that is still being hashed
+class RangeDispenser {
+public:
+  // the few counters before the start counter, which have been hashed before, are handed out again if it is not aligned
+  RangeDispenser(uint64_t startcounter, uint64_t alignment) :
+    alignment(alignment), cursor(startcounter - startcounter % alignment), firstreturned(UINT64_MAX) {}
+
+  // registers a new holder, which holds no range yet
+  // (the holders are only added during the setup, before any range is taken)
+  size_t addHolder() {
+    holders.emplace_back(UINT64_MAX);
+    return holders.size() - 1;
+  }
+
+  // takes the next range [*begin, *begin + *counters) of counters with the given decimal length
+  // for the given holder, which holds it until it is released
+  // the range starts at the first counter that has not been handed out and count(available) decides how many of the
+  // available counters until the length increases are taken (it may be called more than once),
+  // unless all of them are taken, this is rounded down to a multiple of the alignment, such that the next range is aligned
+  // (the powers of ten, where the length increases, are aligned as well)
+  // returns false if the next counter has another length or fewer counters than the alignment are taken
+  template<typename Count>
+  bool take(size_t holder, uint8_t counterlength, Count count, uint64_t* begin, uint64_t* counters) {
+    if (firstreturned.load() != UINT64_MAX && takeReturned(holder, counterlength, count, begin, counters)) {
+      return true;
+    }
+    const uint64_t held = holders[holder].load();
+    uint64_t next = cursor.load();
+    do {
+      *begin = next;
+      if (TSUtil::decimalLength(*begin) != counterlength) {
+        holders[holder].store(held);
+        return false;
+      }
+      *counters = getAligned(count, TSUtil::itsConstantCounterLength(*begin));
+      if (*counters == 0) {
+        holders[holder].store(held);
+        return false;
+      }
+      // the holder has to hold the range before the cursor moves past it
+      holders[holder].store(std::min(held, *begin));
+    } while (!cursor.compare_exchange_weak(next, *begin + *counters));
+    return true;
+  }
+
+  // the holder has finished all its ranges, or has given back what it has not hashed
+  void release(size_t holder) {
+    holders[holder].store(UINT64_MAX);
+  }
+
+  // hands out the range [begin, begin + counters) again, which has been taken before,
+  // e.g. the part of its range an aborted kernel has not reached
+  void giveBack(uint64_t begin, uint64_t counters) {
+    if (counters == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(returnedmutex);
+    returned.push_back(std::make_pair(begin, counters));
+    updateFirstReturned();
+  }
+
+  // the first counter that is handed out next, unless a range of another length is requested
+  uint64_t next() const {
+    return std::min(cursor.load(), firstreturned.load());
+  }
+
+  // the first counter that may not have been hashed yet, all counters before it have been hashed
+  uint64_t firstUnfinished() const {
+    // a range leaves the cursor or the returned ranges only once its holder holds it,
+    // so the holders are read afterwards
+    uint64_t first = next();
+    for (const std::atomic<uint64_t>& held : holders) {
+      first = std::min(first, held.load());
+    }
+    return first;
+  }
+
+private:
+  // takes the first range that has been given back, has the given length and of which count takes counters
+  // the ranges have been handed out before, so they are aligned
+  template<typename Count>
+  bool takeReturned(size_t holder, uint8_t counterlength, Count count, uint64_t* begin, uint64_t* counters) {
+    std::lock_guard<std::mutex> lock(returnedmutex);
+    for (size_t i = 0; i < returned.size(); i++) {
+      std::pair<uint64_t, uint64_t>& range = returned[i];
+      if (TSUtil::decimalLength(range.first) != counterlength) {
+        continue;
+      }
+      const uint64_t taken = getAligned(count, range.second);
+      if (taken == 0) {
+        continue;
+      }
+      *begin = range.first;
+      *counters = taken;
+      holders[holder].store(std::min(holders[holder].load(), *begin));
+      range.first += taken;
+      range.second -= taken;
+      if (range.second == 0) {
+        returned.erase(returned.begin() + i);
+      }
+      updateFirstReturned();
+      return true;
+    }
+    return false;
+  }
+
+  // the counters count takes of the available ones, rounded down to a multiple of the alignment unless it takes all
+  template<typename Count>
+  uint64_t getAligned(Count count, uint64_t available) const {
+    const uint64_t counters = count(available);
+    return counters < available ? counters - counters % alignment : counters;
+  }
+
+  // has to be called with the lock held
+  void updateFirstReturned() {
+    uint64_t first = UINT64_MAX;
+    for (const std::pair<uint64_t, uint64_t>& range : returned) {
+      first = std::min(first, range.first);
+    }
+    firstreturned.store(first);
+  }
+
+  const uint64_t alignment;
+  std::atomic<uint64_t> cursor;
+  // the ranges that have been given back and the first counter among them (UINT64_MAX if there are none)
+  std::mutex returnedmutex;
+  std::vector<std::pair<uint64_t, uint64_t>> returned;
+  std::atomic<uint64_t> firstreturned;
+  // the first counter every holder has not finished (UINT64_MAX if it holds no range)
+  std::deque<std::atomic<uint64_t>> holders;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "Sha1Lanes.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Sha1LanesImpl.h"
+
+#ifdef SHA1LANES_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+
+struct ScalarWord {
+  static const size_t LANES = 1;
+  uint32_t v;
+
+  static ScalarWord make(uint32_t x) { ScalarWord r; r.v = x; return r; }
+  static ScalarWord load(const uint32_t* p) { return make(*p); }
+  static void store(uint32_t* p, ScalarWord x) { *p = x.v; }
+  static ScalarWord set1(uint32_t x) { return make(x); }
+  static ScalarWord add(ScalarWord a, ScalarWord b) { return make(a.v + b.v); }
+  static ScalarWord xor2(ScalarWord a, ScalarWord b) { return make(a.v ^ b.v); }
+  static ScalarWord ch(ScalarWord x, ScalarWord y, ScalarWord z) { return make(z.v ^ (x.v & (y.v ^ z.v))); }
+  static ScalarWord parity(ScalarWord x, ScalarWord y, ScalarWord z) { return make(x.v ^ y.v ^ z.v); }
+  static ScalarWord maj(ScalarWord x, ScalarWord y, ScalarWord z) { return make((x.v & y.v) | (z.v & (x.v | y.v))); }
+  static ScalarWord rotl1(ScalarWord x) { return make((x.v << 1) | (x.v >> 31)); }
+  static ScalarWord rotl5(ScalarWord x) { return make((x.v << 5) | (x.v >> 27)); }
+  static ScalarWord rotl30(ScalarWord x) { return make((x.v << 30) | (x.v >> 2)); }
+};
+
+#ifdef SHA1LANES_X86
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)subleaf);
+  for (int i = 0; i < 4; i++) { regs[i] = (uint32_t)r[i]; }
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// the register state the operating system saves on context switches
+uint64_t xgetbv() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+}
+
+void sha1LanesScalar(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  sha1LanesCompress<ScalarWord>(midstate, words, blocks, digests);
+}
+
+std::vector<Sha1LanesBackend> Sha1Lanes::getSupportedBackends() {
+  std::vector<Sha1LanesBackend> backends;
+  backends.push_back({ "scalar", 1, &sha1LanesScalar });
+
+#ifdef SHA1LANES_X86
+  uint32_t regs[4];
+  cpuid(0, 0, regs);
+  const uint32_t maxleaf = regs[0];
+
+  cpuid(1, 0, regs);
+  const bool sse2 = (regs[3] & (1u << 26)) != 0;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  // the ymm registers and, for AVX-512, the opmask and zmm registers have to be enabled by the OS
+  const uint64_t xcr0 = osxsave ? xgetbv() : 0;
+  const bool os_avx = (xcr0 & 0x6) == 0x6;
+  const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+  bool avx2 = false;
+  bool avx512 = false;
+  bool sha = false;
+  if (maxleaf >= 7) {
+    cpuid(7, 0, regs);
+    avx2 = os_avx && (regs[1] & (1u << 5)) != 0;
+    avx512 = os_avx512 && (regs[1] & (1u << 16)) != 0;
+    sha = sse2 && (regs[1] & (1u << 29)) != 0;
+  }
+
+  if (sse2) { backends.push_back({ "SSE2", 4, &sha1LanesSse2 }); }
+  if (avx2) { backends.push_back({ "AVX2", 8, &sha1LanesAvx2 }); }
+  if (avx512) { backends.push_back({ "AVX-512", 16, &sha1LanesAvx512 }); }
+  if (sha) { backends.push_back({ "SHA-NI", 4, &sha1LanesShaNi }); }
+#endif
+
+  return backends;
+}
+
+Sha1LanesBackend Sha1Lanes::selectFastest() {
+  const std::vector<Sha1LanesBackend> backends = getSupportedBackends();
+  Sha1LanesBackend best = backends[0];
+  double best_speed = 0;
+  for (const Sha1LanesBackend& backend : backends) {
+    const double speed = measureSpeed(backend);
+    if (speed > best_speed) {
+      best = backend;
+      best_speed = speed;
+    }
+  }
+  return best;
+}
+
+double Sha1Lanes::measureSpeed(const Sha1LanesBackend& backend) {
+  using namespace std::chrono;
+  const uint32_t midstate[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+  std::vector<uint32_t> words(16 * backend.lanes);
+  std::vector<uint32_t> digests(5 * backend.lanes);
+
+  // the digest is fed back into the message, so the compressions cannot be skipped
+  const auto begin = high_resolution_clock::now();
+  uint64_t compressions = 0;
+  auto elapsed = high_resolution_clock::duration::zero();
+  while (elapsed < milliseconds(20)) {
+    for (int i = 0; i < 256; i++) {
+      backend.compress(midstate, words.data(), 1, digests.data());
+      words[0] = digests[0];
+    }
+    compressions += 256;
+    elapsed = high_resolution_clock::now() - begin;
+  }
+  return compressions * backend.lanes / (duration_cast<nanoseconds>(elapsed).count() / 1e9);
+}
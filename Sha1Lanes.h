@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SHA1LANES_H_
+#define SHA1LANES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA1LANES_X86
+#endif
+
+// compresses the message blocks of several messages at once, which all start from the same midstate
+// the words are in structure of arrays form, i.e. word t of block b of lane l is
+// words[(16*b + t)*lanes + l], and word j of the digest of lane l is digests[j*lanes + l]
+typedef void(*Sha1LanesFunction)(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+
+struct Sha1LanesBackend {
+  std::string name;
+  // the number of messages that are compressed at once
+  size_t lanes;
+  Sha1LanesFunction compress;
+};
+
+// multi-buffer SHA1 for the native CPU engine (see CpuContext),
+// with one backend per instruction set extension
+class Sha1Lanes {
+public:
+  // the backends the processor and the operating system support,
+  // the scalar one is always supported
+  static std::vector<Sha1LanesBackend> getSupportedBackends();
+
+  // measures all supported backends and returns the fastest one
+  static Sha1LanesBackend selectFastest();
+
+private:
+  static double measureSpeed(const Sha1LanesBackend& backend);
+};
+
+void sha1LanesScalar(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+#ifdef SHA1LANES_X86
+void sha1LanesSse2(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+void sha1LanesAvx2(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+void sha1LanesAvx512(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+void sha1LanesShaNi(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests);
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "Sha1Lanes.h"
+
+#ifdef SHA1LANES_X86
+#include <cstddef>
+#include <cstdint>
+
+#include <immintrin.h>
+
+// the functions of the backend are compiled for AVX2 (see Sha1LanesImpl.h)
+#if defined(__GNUC__)
+#define SHA1LANES_TARGET __attribute__((target("avx2")))
+#else
+#define SHA1LANES_TARGET
+#endif
+#include "Sha1LanesImpl.h"
+
+namespace {
+
+struct Avx2Word {
+  static const size_t LANES = 8;
+  __m256i v;
+
+  SHA1LANES_TARGET static Avx2Word make(__m256i x) { Avx2Word r; r.v = x; return r; }
+  SHA1LANES_TARGET static Avx2Word load(const uint32_t* p) { return make(_mm256_loadu_si256((const __m256i*)p)); }
+  SHA1LANES_TARGET static void store(uint32_t* p, Avx2Word x) { _mm256_storeu_si256((__m256i*)p, x.v); }
+  SHA1LANES_TARGET static Avx2Word set1(uint32_t x) { return make(_mm256_set1_epi32((int)x)); }
+  SHA1LANES_TARGET static Avx2Word add(Avx2Word a, Avx2Word b) { return make(_mm256_add_epi32(a.v, b.v)); }
+  SHA1LANES_TARGET static Avx2Word xor2(Avx2Word a, Avx2Word b) { return make(_mm256_xor_si256(a.v, b.v)); }
+  SHA1LANES_TARGET static Avx2Word ch(Avx2Word x, Avx2Word y, Avx2Word z) {
+    return make(_mm256_xor_si256(z.v, _mm256_and_si256(x.v, _mm256_xor_si256(y.v, z.v))));
+  }
+  SHA1LANES_TARGET static Avx2Word parity(Avx2Word x, Avx2Word y, Avx2Word z) {
+    return make(_mm256_xor_si256(_mm256_xor_si256(x.v, y.v), z.v));
+  }
+  SHA1LANES_TARGET static Avx2Word maj(Avx2Word x, Avx2Word y, Avx2Word z) {
+    return make(_mm256_or_si256(_mm256_and_si256(x.v, y.v), _mm256_and_si256(z.v, _mm256_or_si256(x.v, y.v))));
+  }
+  SHA1LANES_TARGET static Avx2Word rotl1(Avx2Word x) { return make(_mm256_or_si256(_mm256_slli_epi32(x.v, 1), _mm256_srli_epi32(x.v, 31))); }
+  SHA1LANES_TARGET static Avx2Word rotl5(Avx2Word x) { return make(_mm256_or_si256(_mm256_slli_epi32(x.v, 5), _mm256_srli_epi32(x.v, 27))); }
+  SHA1LANES_TARGET static Avx2Word rotl30(Avx2Word x) { return make(_mm256_or_si256(_mm256_slli_epi32(x.v, 30), _mm256_srli_epi32(x.v, 2))); }
+};
+
+}
+
+SHA1LANES_TARGET void sha1LanesAvx2(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  sha1LanesCompress<Avx2Word>(midstate, words, blocks, digests);
+}
+#endif
@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "Sha1Lanes.h"
+
+#ifdef SHA1LANES_X86
+#include <cstddef>
+#include <cstdint>
+
+// some versions of GCC falsely warn about the undefined source operand in the AVX-512 headers
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+
+// the functions of the backend are compiled for AVX-512 (see Sha1LanesImpl.h)
+#if defined(__GNUC__)
+#define SHA1LANES_TARGET __attribute__((target("avx512f")))
+#else
+#define SHA1LANES_TARGET
+#endif
+#include "Sha1LanesImpl.h"
+
+namespace {
+
+// the select, parity and majority functions are single ternary logic instructions,
+// their immediates are the truth tables over x=0xf0, y=0xcc and z=0xaa
+struct Avx512Word {
+  static const size_t LANES = 16;
+  __m512i v;
+
+  SHA1LANES_TARGET static Avx512Word make(__m512i x) { Avx512Word r; r.v = x; return r; }
+  SHA1LANES_TARGET static Avx512Word load(const uint32_t* p) { return make(_mm512_loadu_si512((const void*)p)); }
+  SHA1LANES_TARGET static void store(uint32_t* p, Avx512Word x) { _mm512_storeu_si512((void*)p, x.v); }
+  SHA1LANES_TARGET static Avx512Word set1(uint32_t x) { return make(_mm512_set1_epi32((int)x)); }
+  SHA1LANES_TARGET static Avx512Word add(Avx512Word a, Avx512Word b) { return make(_mm512_add_epi32(a.v, b.v)); }
+  SHA1LANES_TARGET static Avx512Word xor2(Avx512Word a, Avx512Word b) { return make(_mm512_xor_si512(a.v, b.v)); }
+  SHA1LANES_TARGET static Avx512Word ch(Avx512Word x, Avx512Word y, Avx512Word z) { return make(_mm512_ternarylogic_epi32(x.v, y.v, z.v, 0xca)); }
+  SHA1LANES_TARGET static Avx512Word parity(Avx512Word x, Avx512Word y, Avx512Word z) { return make(_mm512_ternarylogic_epi32(x.v, y.v, z.v, 0x96)); }
+  SHA1LANES_TARGET static Avx512Word maj(Avx512Word x, Avx512Word y, Avx512Word z) { return make(_mm512_ternarylogic_epi32(x.v, y.v, z.v, 0xe8)); }
+  SHA1LANES_TARGET static Avx512Word rotl1(Avx512Word x) { return make(_mm512_rol_epi32(x.v, 1)); }
+  SHA1LANES_TARGET static Avx512Word rotl5(Avx512Word x) { return make(_mm512_rol_epi32(x.v, 5)); }
+  SHA1LANES_TARGET static Avx512Word rotl30(Avx512Word x) { return make(_mm512_rol_epi32(x.v, 30)); }
+};
+
+}
+
+SHA1LANES_TARGET void sha1LanesAvx512(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  sha1LanesCompress<Avx512Word>(midstate, words, blocks, digests);
+}
+#endif
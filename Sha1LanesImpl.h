@@ -0,0 +1,90 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SHA1LANESIMPL_H_
+#define SHA1LANESIMPL_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// the SHA1 compression on a vector type V, which holds one 32bit word of every lane
+// and is defined by every backend, compiled with its instruction set extension
+// V provides LANES, load, store, set1, add, xor2, ch, parity, maj, rotl1, rotl5 and rotl30
+
+// a backend defines SHA1LANES_TARGET as the target attribute of its instruction set extension
+// before including this header, only its functions are compiled for the extension, not the whole file,
+// and as its V has internal linkage, none of them can be shared with another file
+#ifndef SHA1LANES_TARGET
+#define SHA1LANES_TARGET
+#endif
+
+template <class V>
+SHA1LANES_TARGET inline void sha1LanesRound(V s[5], const V f, const uint32_t k, const V w) {
+  const V tmp = V::add(V::add(V::rotl5(s[0]), f), V::add(V::add(s[4], V::set1(k)), w));
+  s[4] = s[3];
+  s[3] = s[2];
+  s[2] = V::rotl30(s[1]);
+  s[1] = s[0];
+  s[0] = tmp;
+}
+
+// the message schedule is kept as a ring of 16 words
+template <class V>
+SHA1LANES_TARGET inline V sha1LanesExpand(V w[16], const int t) {
+  w[t & 15] = V::rotl1(V::xor2(V::parity(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15]), w[t & 15]));
+  return w[t & 15];
+}
+
+template <class V>
+SHA1LANES_TARGET inline void sha1LanesCompress(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  const size_t lanes = V::LANES;
+  V state[5];
+  for (int j = 0; j < 5; j++) { state[j] = V::set1(midstate[j]); }
+
+  for (size_t b = 0; b < blocks; b++) {
+    V w[16];
+    V s[5];
+    for (int j = 0; j < 5; j++) { s[j] = state[j]; }
+
+    for (int t = 0; t < 16; t++) {
+      w[t] = V::load(words + (16 * b + t) * lanes);
+      sha1LanesRound(s, V::ch(s[1], s[2], s[3]), 0x5a827999, w[t]);
+    }
+    for (int t = 16; t < 20; t++) {
+      sha1LanesRound(s, V::ch(s[1], s[2], s[3]), 0x5a827999, sha1LanesExpand(w, t));
+    }
+    for (int t = 20; t < 40; t++) {
+      sha1LanesRound(s, V::parity(s[1], s[2], s[3]), 0x6ed9eba1, sha1LanesExpand(w, t));
+    }
+    for (int t = 40; t < 60; t++) {
+      sha1LanesRound(s, V::maj(s[1], s[2], s[3]), 0x8f1bbcdc, sha1LanesExpand(w, t));
+    }
+    for (int t = 60; t < 80; t++) {
+      sha1LanesRound(s, V::parity(s[1], s[2], s[3]), 0xca62c1d6, sha1LanesExpand(w, t));
+    }
+
+    for (int j = 0; j < 5; j++) { state[j] = V::add(state[j], s[j]); }
+  }
+
+  for (int j = 0; j < 5; j++) { V::store(digests + j * lanes, state[j]); }
+}
+
+#endif
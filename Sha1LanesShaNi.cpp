@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "Sha1Lanes.h"
+
+#ifdef SHA1LANES_X86
+#include <cstddef>
+#include <cstdint>
+
+#include <immintrin.h>
+
+// the functions of the backend are compiled for the SHA extensions, not the whole file
+#if defined(__GNUC__)
+#define SHA1LANES_TARGET __attribute__((target("sha")))
+#else
+#define SHA1LANES_TARGET
+#endif
+
+namespace {
+
+const size_t SHANI_LANES = 4;
+
+// the SHA instructions compress a single message, we run them for every lane in turn
+// the state is held as abcd in one register, with a in the highest element, and e in the
+// highest element of another one, the message words are in the same reversed order
+SHA1LANES_TARGET void sha1ShaNi(const uint32_t midstate[5], const uint32_t* words, size_t lane, size_t blocks, uint32_t* digests) {
+  __m128i abcd = _mm_set_epi32((int)midstate[0], (int)midstate[1], (int)midstate[2], (int)midstate[3]);
+  __m128i e0 = _mm_set_epi32((int)midstate[4], 0, 0, 0);
+
+  for (size_t b = 0; b < blocks; b++) {
+    const uint32_t* block = words + 16 * b * SHANI_LANES + lane;
+    __m128i msg[4];
+    for (int i = 0; i < 4; i++) {
+      msg[i] = _mm_set_epi32((int)block[(4 * i) * SHANI_LANES], (int)block[(4 * i + 1) * SHANI_LANES],
+        (int)block[(4 * i + 2) * SHANI_LANES], (int)block[(4 * i + 3) * SHANI_LANES]);
+    }
+
+    const __m128i abcd_save = abcd;
+    const __m128i e0_save = e0;
+    __m128i e1;
+
+    // the rounds 4*g to 4*g+3 use msg[g%4], which is expanded ahead of them
+    e0 = _mm_add_epi32(e0, msg[0]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    for (int g = 1; g < 20; g++) {
+      __m128i& m = msg[g % 4];
+      if (g % 2 == 1) {
+        e1 = _mm_sha1nexte_epu32(e1, m);
+        e0 = abcd;
+      }
+      else {
+        e0 = _mm_sha1nexte_epu32(e0, m);
+        e1 = abcd;
+      }
+      if (g >= 3 && g <= 18) { msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], m); }
+      switch (g / 5) {
+      case 0: abcd = _mm_sha1rnds4_epu32(abcd, g % 2 == 1 ? e1 : e0, 0); break;
+      case 1: abcd = _mm_sha1rnds4_epu32(abcd, g % 2 == 1 ? e1 : e0, 1); break;
+      case 2: abcd = _mm_sha1rnds4_epu32(abcd, g % 2 == 1 ? e1 : e0, 2); break;
+      default: abcd = _mm_sha1rnds4_epu32(abcd, g % 2 == 1 ? e1 : e0, 3); break;
+      }
+      if (g <= 16) { msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], m); }
+      if (g >= 2 && g <= 17) { msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], m); }
+    }
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  uint32_t s[4];
+  _mm_storeu_si128((__m128i*)s, abcd);
+  uint32_t e[4];
+  _mm_storeu_si128((__m128i*)e, e0);
+  for (int j = 0; j < 4; j++) { digests[j * SHANI_LANES + lane] = s[3 - j]; }
+  digests[4 * SHANI_LANES + lane] = e[3];
+}
+
+}
+
+SHA1LANES_TARGET void sha1LanesShaNi(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  for (size_t lane = 0; lane < SHANI_LANES; lane++) {
+    sha1ShaNi(midstate, words, lane, blocks, digests);
+  }
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include "Sha1Lanes.h"
+
+#ifdef SHA1LANES_X86
+#include <cstddef>
+#include <cstdint>
+
+#include <emmintrin.h>
+
+#include "Sha1LanesImpl.h"
+
+namespace {
+
+struct Sse2Word {
+  static const size_t LANES = 4;
+  __m128i v;
+
+  static Sse2Word make(__m128i x) { Sse2Word r; r.v = x; return r; }
+  static Sse2Word load(const uint32_t* p) { return make(_mm_loadu_si128((const __m128i*)p)); }
+  static void store(uint32_t* p, Sse2Word x) { _mm_storeu_si128((__m128i*)p, x.v); }
+  static Sse2Word set1(uint32_t x) { return make(_mm_set1_epi32((int)x)); }
+  static Sse2Word add(Sse2Word a, Sse2Word b) { return make(_mm_add_epi32(a.v, b.v)); }
+  static Sse2Word xor2(Sse2Word a, Sse2Word b) { return make(_mm_xor_si128(a.v, b.v)); }
+  static Sse2Word ch(Sse2Word x, Sse2Word y, Sse2Word z) {
+    return make(_mm_xor_si128(z.v, _mm_and_si128(x.v, _mm_xor_si128(y.v, z.v))));
+  }
+  static Sse2Word parity(Sse2Word x, Sse2Word y, Sse2Word z) {
+    return make(_mm_xor_si128(_mm_xor_si128(x.v, y.v), z.v));
+  }
+  static Sse2Word maj(Sse2Word x, Sse2Word y, Sse2Word z) {
+    return make(_mm_or_si128(_mm_and_si128(x.v, y.v), _mm_and_si128(z.v, _mm_or_si128(x.v, y.v))));
+  }
+  static Sse2Word rotl1(Sse2Word x) { return make(_mm_or_si128(_mm_slli_epi32(x.v, 1), _mm_srli_epi32(x.v, 31))); }
+  static Sse2Word rotl5(Sse2Word x) { return make(_mm_or_si128(_mm_slli_epi32(x.v, 5), _mm_srli_epi32(x.v, 27))); }
+  static Sse2Word rotl30(Sse2Word x) { return make(_mm_or_si128(_mm_slli_epi32(x.v, 30), _mm_srli_epi32(x.v, 2))); }
+};
+
+}
+
+void sha1LanesSse2(const uint32_t midstate[5], const uint32_t* words, size_t blocks, uint32_t* digests) {
+  sha1LanesCompress<Sse2Word>(midstate, words, blocks, digests);
+}
+#endif
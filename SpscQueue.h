@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2017 landave
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// a bounded queue between a single producing and a single consuming thread
+// the elements are passed through a ring buffer without locking,
+// the mutex is only needed to let the consumer sleep until an element arrives
+template<typename T>
+class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity) : elements(capacity + 1), head(0), tail(0), closed(false) {}
+
+  // returns false if the queue is full
+  bool push(T value) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t next = (t + 1) % elements.size();
+    if (next == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    elements[t] = std::move(value);
+    tail.store(next, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(m);
+    cv.notify_one();
+    return true;
+  }
+
+  // waits for the next element, returns false once the queue is closed and empty
+  bool pop(T* value) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      std::unique_lock<std::mutex> lock(m);
+      cv.wait(lock, [&] { return h != tail.load(std::memory_order_acquire) || closed; });
+      if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+    }
+    *value = std::move(elements[h]);
+    head.store((h + 1) % elements.size(), std::memory_order_release);
+    return true;
+  }
+
+  // the consumer returns false from pop as soon as it has taken all remaining elements
+  void close() {
+    std::lock_guard<std::mutex> lock(m);
+    closed = true;
+    cv.notify_one();
+  }
+
+private:
+  std::vector<T> elements;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  std::condition_variable cv;
+  std::mutex m;
+  bool closed;
+};
+
+#endif
@@ -28,6 +28,7 @@ SOFTWARE.
 #include <atomic>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <mutex>
 #include <regex>
 #include <string>
@@ -38,18 +39,20 @@ SOFTWARE.
 #include <CL/cl.hpp>
 
 #include "Config.h"
+#include "CpuContext.h"
 #include "DeviceContext.h"
+#include "IdentityState.h"
 #include "Kernel.h"
+#include "KernelGenerator.h"
 #include "sha1.h"
+#include "Sha1Lanes.h"
+#include "SpscQueue.h"
 #include "Table.h"
 #include "TSUtil.h"
 #include "TimerKiller.h"
 #include "TunedParameters.h"
 
 
-const char* TSHasherContext::KERNEL_NAME = "TeamSpeakHasher";
-const char* TSHasherContext::KERNEL_NAME2 = "TeamSpeakHasher2";
-
 const char* TSHasherContext::BUILD_OPTS_BASE = "-I . -I src";
 
 const size_t TSHasherContext::MAX_DEVICES = 16;
@@ -57,6 +60,38 @@ const size_t TSHasherContext::DEV_DEFAULT_LOCAL_WORK_SIZE = 32;
 const size_t TSHasherContext::DEV_DEFAULT_GLOBAL_WORK_SIZE = 64 * 4096;
 const uint64_t TSHasherContext::MAX_GLOBALLOCAL_RATIO = (1 << 16);
 const size_t TSHasherContext::KERNEL_STD_ITERATIONS = 1024;
+const uint64_t TSHasherContext::MAX_LAUNCH_ITERATIONS = 1 << 16;
+const cl_uint TSHasherContext::MAX_VECTOR_SIZE = 8;
+// CPUs with AVX-512 hold 16 lanes in one register
+const cl_uint TSHasherContext::MAX_CPU_VECTOR_SIZE = 16;
+// the kernels hash all ten values of the last digit at once (see hashDecade in Kernel.h)
+const cl_uint TSHasherContext::DIGIT_BATCH = 10;
+// the capacity of the hit buffer of a kernel
+// note that only hashes reaching the target difficulty are reported,
+// so we expect far less than one hit per kernel
+const cl_uint TSHasherContext::MAX_HITS = 64;
+// run_kernel_loop keeps one group of launches running, one queued behind it and one whose results are read
+const cl_uint TSHasherContext::IN_FLIGHT_LAUNCHES = 3;
+// the most launches of a group, whose results are read at once (the tuner chooses how many)
+const cl_uint TSHasherContext::MAX_COALESCED_LAUNCHES = 8;
+// the kernel variants the tuner searches (see TunedParameters)
+const cl_uint TSHasherContext::MAX_CHAINS = 4;
+const cl_uint TSHasherContext::MAX_ITERATION_UNROLL = 4;
+// the compiler flags must not change the results of the kernels
+const std::vector<const char*> TSHasherContext::VARIANT_BUILD_FLAGS = { "-cl-mad-enable" };
+// the running kernels check every ABORT_POLL_ITERATIONS iterations whether they are stopped
+const cl_uint TSHasherContext::ABORT_POLL_ITERATIONS = 32;
+// the persistent kernel runs this many work groups per compute unit,
+// every group claims chunks of PERSISTENT_CHUNK_ITERATIONS iterations per work item
+const cl_uint TSHasherContext::PERSISTENT_GROUPS_PER_COMPUTE_UNIT = 4;
+const cl_uint TSHasherContext::PERSISTENT_CHUNK_ITERATIONS = 64;
+// the number of leases a launch of the persistent kernel hashes, which bounds how long it runs
+const cl_uint TSHasherContext::PERSISTENT_LAUNCH_LEASES = 16;
+// the number of counters a thread of the native CPU engine takes at once
+const uint64_t TSHasherContext::CPU_RANGE_COUNTERS = 1 << 18;
+// the share of the running time the host of a device spends on recomputing audited work items,
+// which overlaps with the queued kernels
+const double TSHasherContext::AUDIT_MAX_SHARE = 0.02;
 
 #define VENDOR_ID_GENERIC 0
 #define VENDOR_ID_AMD 1
@@ -85,18 +120,63 @@ void TSHasherContext::clearConsole() {
 TSHasherContext::TSHasherContext(std::string identity,
   uint64_t startcounter,
   uint64_t bestcounter,
-  uint64_t throttlefactor) :
-  startcounter(startcounter),
+  uint64_t throttlefactor,
+  ComputeOptions options) :
+  aborted(false),
+  dispenser(startcounter, DIGIT_BATCH),
   global_bestdifficulty(TSUtil::getDifficulty(identity, bestcounter)),
   global_bestdifficulty_counter(bestcounter),
   identity(identity),
-  throttlefactor(throttlefactor) {
+  throttlefactor(throttlefactor),
+  options(options) {
   MIN_TARGET_DIFFICULTY = 34;
+  setupDevices();
+}
+
+TSHasherContext::TSHasherContext(std::vector<BatchIdentity> identities,
+  uint64_t throttlefactor,
+  ComputeOptions options) :
+  aborted(false),
+  dispenser(identities[0].startcounter, DIGIT_BATCH),
+  global_bestdifficulty(identities[0].bestdifficulty),
+  global_bestdifficulty_counter(identities[0].bestdifficulty_counter),
+  batch(std::move(identities)),
+  identity(batch[0].identity),
+  throttlefactor(throttlefactor),
+  options(options) {
+  // the target is not lowered by the estimates of a single identity (see printinfo),
+  // so we start with the lowest one the kernels can report
+  MIN_TARGET_DIFFICULTY = 32;
+  setupDevices();
+}
+
+void TSHasherContext::setupDevices() {
+  // the complete blocks of the identity are the same for every counter,
+  // so we compress them only once here instead of in every work item
+  // (the states of a batch follow each other in the order of the batch)
+  std::vector<uint32_t> identitystate_buffer;
+  if (options.batch) {
+    for (const BatchIdentity& member : batch) {
+      const std::vector<uint32_t> state = IdentityState(member.identity).toKernelBuffer();
+      identitystate_buffer.insert(identitystate_buffer.end(), state.begin(), state.end());
+    }
+  }
+  else {
+    identitystate_buffer = IdentityState(identity).toKernelBuffer();
+  }
 
   std::vector<cl::Platform> platforms;
 
   std::vector<uint32_t> vendor_ids;
 
+  cl_device_type devicetypes = CL_DEVICE_TYPE_GPU;
+  if (options.devices == DEVICES_CPU) {
+    devicetypes = CL_DEVICE_TYPE_CPU;
+  }
+  else if (options.devices == DEVICES_ALL) {
+    devicetypes = CL_DEVICE_TYPE_CPU | CL_DEVICE_TYPE_GPU;
+  }
+
   cl::Platform::get(&platforms);
   for (uint32_t i = 0; i < platforms.size(); i++) {
     auto& platform = platforms[i];
@@ -115,14 +195,18 @@ TSHasherContext::TSHasherContext(std::string identity,
 
 
     std::vector<cl::Device> tmp_devices;
-    platform.getDevices(DEV_TYPE, &tmp_devices);
+    platform.getDevices(devicetypes, &tmp_devices);
     devices.insert(std::end(devices), std::begin(tmp_devices), std::end(tmp_devices));
     vendor_ids.insert(std::end(vendor_ids), tmp_devices.size(), platform_vendor_id);
   }
-  if (devices.size() == 0) {
-    std::cerr << "Error: No devices have been found." << std::endl;
+  if (devices.size() == 0 && options.batch) {
+    std::cout << "Error: No OpenCL devices have been found, which are needed to compute a batch." << std::endl;
     exit(-1);
   }
+  if (devices.size() == 0 && !this->options.native) {
+    std::cout << "No OpenCL devices have been found, using the native CPU engine instead." << std::endl;
+    this->options.native = true;
+  }
 
 
   for (cl_uint device_id = 0; device_id < devices.size(); device_id++) {
@@ -130,14 +214,18 @@ TSHasherContext::TSHasherContext(std::string identity,
 
     cl::Context context({ device });
 
-    cl::Program::Sources sources;
-    sources.push_back({ KERNEL_CODE, strlen(KERNEL_CODE) });
-
-    cl::Program program(context, sources);
-
     cl_device_type devicetype = device.getInfo <CL_DEVICE_TYPE>();
 
-    cl_uint vector_width = device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_INT>();
+    // CPU devices get a kernel of their own (see CPU_KERNEL in Kernel.h)
+    const bool cpukernel = (devicetype & CL_DEVICE_TYPE_CPU) != 0;
+
+    // the kernel supports vector sizes 1, 2, 4 and 8, and 16 on CPUs
+    const cl_uint max_vector_size = cpukernel ? MAX_CPU_VECTOR_SIZE : MAX_VECTOR_SIZE;
+    const cl_uint vector_width = device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_INT>();
+    cl_uint native_vector_size = 1;
+    while (2 * native_vector_size <= std::min(vector_width, max_vector_size)) {
+      native_vector_size *= 2;
+    }
 
     uint32_t vendor_id = vendor_ids[device_id];
 
@@ -154,27 +242,40 @@ TSHasherContext::TSHasherContext(std::string identity,
       sizeof(build_opts) - 1,
       "%s -D VENDOR_ID=%u "
       "-D CUDA_ARCH=%u "
-      "-D VECT_SIZE=%u "
       "-D DEVICE_TYPE=%u "
+      "-D DIGIT_BATCH=%u "
+      "-D MAX_HITS=%u "
+      "-D MAX_LEASES=%u "
+      "-D ABORT_POLL_ITERATIONS=%u "
+      "-D HISTOGRAM_BINS=%u "
       "-D _unroll "
+      "%s"
+      "%s"
+      "%s"
+      "%s"
+      "%s"
+      "%s"
       "-cl-std=CL1.2 -w",
       BUILD_OPTS_BASE,
       vendor_id,
       (sm_major * 100) + sm_minor,
-      vector_width,
-      (uint32_t)devicetype);
-
-
-    if (program.build({ device }, build_opts) != CL_SUCCESS) {
-      std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
-      exit(1);
-    }
-
-    cl::Kernel kernel(program, KERNEL_NAME);
-    cl::Kernel kernel2(program, KERNEL_NAME2);
-
-
-    cl::CommandQueue command_queue(context, device);
+      (uint32_t)devicetype,
+      DIGIT_BATCH,
+      MAX_HITS,
+      WorkQueue::MAX_LEASES,
+      ABORT_POLL_ITERATIONS,
+      DifficultyHistogram::BINS,
+      options.layout == LAYOUT_INTERLEAVED ? "-D INTERLEAVED_LAYOUT " : "",
+      options.persistent ? "-D PERSISTENT_KERNEL " : "",
+      cpukernel ? "-D CPU_KERNEL " : "",
+      options.batch ? "-D IDENTITY_BATCH " : "",
+      options.histogram ? "-D DIFFICULTY_HISTOGRAM " : "",
+      options.audit ? "-D COVERAGE_AUDIT " : "");
+
+
+    // run_kernel_loop keeps several launches in flight, the queue profiles the idle time between them
+    const bool pipelined = !options.persistent && !options.batch;
+    cl::CommandQueue command_queue(context, device, pipelined ? CL_QUEUE_PROFILING_ENABLE : 0);
 
     cl_uint max_compute_units = device.getInfo <CL_DEVICE_MAX_COMPUTE_UNITS>();
 
@@ -189,27 +290,121 @@ TSHasherContext::TSHasherContext(std::string identity,
 
     size_t global_work_size = DEV_DEFAULT_GLOBAL_WORK_SIZE;
     size_t local_work_size = DEV_DEFAULT_LOCAL_WORK_SIZE;
-    auto bestgloballocal = tune(&device, device_id, build_opts);
-    global_work_size = std::max(bestgloballocal.first / throttlefactor, bestgloballocal.second);
-    local_work_size = bestgloballocal.second;
+    TunedParameters tunedparams = tune(&device, device_id, vendor_id, build_opts, native_vector_size, max_vector_size);
+    global_work_size = std::max(tunedparams.globalworksize / throttlefactor, tunedparams.localworksize);
+    local_work_size = tunedparams.localworksize;
+    const cl_uint vector_size = (cl_uint)tunedparams.vectorsize;
+    const cl_uint chains = (cl_uint)tunedparams.chains;
+
+    // the programs are specialized for the kernel variant, the identity and the counter length,
+    // we build the one for the current counter length right away
+    const std::string kernel_build_opts = std::string(build_opts) + tunedparams.getBuildOptions();
+    KernelGenerator kernelgenerator(context, device, KERNEL_CODE, kernel_build_opts, identity.size(), options.persistent);
+    if (options.batch) {
+      kernelgenerator.getBatchKernel(TSUtil::decimalLength(dispenser.next()));
+    }
+    else {
+      kernelgenerator.getKernel(TSUtil::decimalLength(dispenser.next()));
+    }
 
     // device memory
-    const size_t size_results = global_work_size * sizeof(uint8_t);
-
-    cl::Buffer d_results(context, CL_MEM_WRITE_ONLY, size_results);
-    cl::Buffer d_identity(context, CL_MEM_READ_ONLY, identity.size());
+    const size_t size_hits = MAX_HITS * sizeof(HitRecord);
+
+    const size_t size_identitystate = identitystate_buffer.size() * sizeof(uint32_t);
+
+    cl::Buffer d_identitystate(context, CL_MEM_READ_ONLY, size_identitystate);
+    command_queue.enqueueWriteBuffer(d_identitystate, CL_TRUE, 0, size_identitystate, identitystate_buffer.data());
+
+    // every launch in flight has its own results, the progress is only written
+    // by aborted work items, so all others stay at the initial value (see readProgress)
+    // run_kernel_loop reads the results of as many launches at once as the tuner has found best
+    const std::vector<uint32_t> initial_progress(global_work_size, UINT32_MAX);
+    std::vector<LaunchGroup> groups(pipelined ? IN_FLIGHT_LAUNCHES : 1);
+    const size_t launches_per_group = pipelined ? (size_t)std::max((uint64_t)1, tunedparams.coalesce) : 1;
+
+    // the results are mapped after every group, so they are allocated in memory the host can access,
+    // which the device either shares or transfers to by DMA without staging it
+    // the sub-buffers of the launches have to start at the base address alignment of the device
+    // every bin of the difficulty histogram takes two words (see flushGroupHistogram in Kernel.h)
+    const size_t base_align = std::max((cl_uint)8, device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>()) / 8;
+    auto aligned = [base_align](size_t size) -> size_t {
+      return (size + base_align - 1) / base_align * base_align;
+    };
+    const size_t size_histogram = 2 * DifficultyHistogram::BINS * sizeof(cl_uint);
+    for (LaunchGroup& group : groups) {
+      group.histogramoffset = aligned(sizeof(cl_uint));
+      group.hitsoffset = group.histogramoffset + aligned(size_histogram);
+      group.regionsize = aligned(group.hitsoffset + size_hits);
+      group.d_results = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, launches_per_group * group.regionsize);
+      group.h_results = nullptr;
+      group.launched = 0;
+      const std::vector<uint8_t> zero_results(launches_per_group * group.regionsize, 0);
+      command_queue.enqueueWriteBuffer(group.d_results, CL_TRUE, 0, zero_results.size(), zero_results.data());
+
+      group.launches.resize(launches_per_group);
+      for (size_t k = 0; k < launches_per_group; k++) {
+        LaunchSlot& slot = group.launches[k];
+        auto subbuffer = [&group, k](size_t offset, size_t size) -> cl::Buffer {
+          const cl_buffer_region region = { k * group.regionsize + offset, size };
+          return group.d_results.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+        };
+        slot.d_hitcount = subbuffer(0, sizeof(cl_uint));
+        slot.d_histogram = subbuffer(group.histogramoffset, size_histogram);
+        slot.d_hits = subbuffer(group.hitsoffset, size_hits);
+        slot.d_progress = cl::Buffer(context, CL_MEM_WRITE_ONLY, global_work_size * sizeof(cl_uint));
+        slot.h_progress.resize(global_work_size);
+        slot.d_checksums = cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, global_work_size * sizeof(cl_uint));
+        command_queue.enqueueWriteBuffer(slot.d_progress, CL_TRUE, 0, global_work_size * sizeof(cl_uint), initial_progress.data());
+        slot.holder = dispenser.addHolder();
+      }
+    }
 
+    // the work queue of the persistent kernel is written by the host before every launch,
+    // the claim cursor is only accessed by the kernel
+    cl::Buffer d_cursor;
+    cl::Buffer d_workqueue;
+    if (options.persistent) {
+      d_cursor = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+      d_workqueue = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(WorkQueue));
+    }
 
-    // host memory
-    auto h_results = new uint8_t[global_work_size]();
-    command_queue.enqueueWriteBuffer(d_results, CL_TRUE, 0, size_results, h_results);
-    const cl_uint identity_length = (cl_uint)identity.size();
-    command_queue.enqueueWriteBuffer(d_identity, CL_TRUE, 0, identity_length, identity.c_str());
+    // the abort word is written through its own queue while the kernels run (see DeviceContext)
+    cl::Buffer d_abortword(context, CL_MEM_READ_ONLY, sizeof(cl_uint));
+    const cl_uint zero = 0;
+    command_queue.enqueueWriteBuffer(d_abortword, CL_TRUE, 0, sizeof(cl_uint), &zero);
+    cl::CommandQueue abort_queue(context, device);
+
+    // the contexts are constructed in place, since they are shared with the threads of the devices
+    dev_ctxs.emplace_back(device_name, device, context, kernelgenerator, command_queue, this,
+      max_compute_units, devicetype, global_work_size, local_work_size, vector_size, chains, DIGIT_BATCH,
+      tunedparams.getVariantDescription(),
+      std::move(groups), d_identitystate, d_cursor, d_workqueue,
+      d_abortword, abort_queue, identity);
+    DeviceContext& dev_ctx = dev_ctxs.back();
+    // until the speed has been measured, the launches run the iterations the tuning used
+    dev_ctx.launchiterations = KERNEL_STD_ITERATIONS;
+    // the leases of the persistent kernel are held together
+    dev_ctx.leaseholder = dispenser.addHolder();
+
+    if (options.batch) {
+      checkBatchKernel(&dev_ctx);
+    }
+  }
 
-    DeviceContext dev_ctx(device_name, device, context, program, kernel, kernel2, command_queue, this,
-      max_compute_units, devicetype, global_work_size, local_work_size, d_results, d_identity, h_results, identity);
+  if (this->options.native) {
+    // every OpenCL device needs a host thread, the remaining cores hash natively
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    unsigned threads = this->options.nativethreads;
+    if (threads == 0) {
+      threads = cores - std::min(cores - 1, (unsigned)devices.size());
+    }
+    cpu_ctx.reset(new CpuContext(this, threads, identity));
+    std::cout << "  Native CPU engine: " << threads << " threads, " << cpu_ctx->getVariantDescription() << std::endl;
+  }
 
-    dev_ctxs.push_back(dev_ctx);
+  if (this->options.audit) {
+    // the checksums of the audited work items are recomputed with the native engine
+    auditbackend = Sha1Lanes::selectFastest();
   }
 
   Config::store();
@@ -230,74 +425,150 @@ std::string TSHasherContext::getDeviceIdentifier(cl::Device* device,
   return std::regex_replace(devicename, target, replacement);
 }
 
-std::pair<uint64_t, uint64_t> TSHasherContext::tune(cl::Device* device,
+TunedParameters TSHasherContext::tune(cl::Device* device,
   cl_uint device_id,
-  const char* build_opts) {
+  uint32_t vendor_id,
+  const char* build_opts,
+  cl_uint native_vector_size,
+  cl_uint max_vector_size) {
   using namespace std::chrono;
   auto devicename = std::string(device->getInfo<CL_DEVICE_NAME>().c_str());
   auto regex = std::regex{ R"([^\w])" };
   devicename = std::regex_replace(devicename, regex, std::string{ "_" });
   std::string deviceidentifier = getDeviceIdentifier(device, device_id);
   auto conf = Config::tuned.find(deviceidentifier);
-  if (conf != Config::tuned.end()) {
-    return { conf->second.globalworksize, conf->second.localworksize };
+  // the CPU kernel runs one work item per compute unit, each of which hashes a long contiguous range
+  // (the iterations per launch adapt to the kernel time), so only the kernel variant is tuned
+  const bool cpukernel = (device->getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU) != 0;
+  const size_t compute_units = device->getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+  // parameters without a vector size, without the number of chains, without the number of
+  // coalesced launches or with compiler flags that are no longer tried have been tuned by an older version,
+  // so we tune these again
+  auto knownflags = [](const std::string& buildflags) -> bool {
+    return buildflags.empty() || std::find(VARIANT_BUILD_FLAGS.begin(), VARIANT_BUILD_FLAGS.end(), buildflags) != VARIANT_BUILD_FLAGS.end();
+  };
+  // CPU parameters with larger work groups have been tuned before the CPU kernel existed
+  if (conf != Config::tuned.end() && conf->second.vectorsize != 0 && conf->second.chains != 0 && conf->second.coalesce != 0
+    && knownflags(conf->second.buildflags) && (!cpukernel || conf->second.localworksize == 1)) {
+    return conf->second;
   }
 
   std::cout << "  Tuning... " << std::endl;
 
 
-  uint64_t besttime = UINT64_MAX;
-  std::pair<uint64_t, uint64_t> result;
+  double besttime = std::numeric_limits<double>::max();
+  // we start with the native vector size and the variant that has been used before variants were tuned
+  // (bitselect has only been used on NVIDIA and AMD devices, see USE_BITSELECT in Kernel.h)
+  const uint64_t base_bitselect = vendor_id == VENDOR_ID_GENERIC ? 0 : 1;
+  TunedParameters result(devicename, deviceidentifier, 0, 0, native_vector_size, 1, 1, base_bitselect, 1, "", 1);
   cl_ulong tunestartcounter = 10000000000000000000ULL;
   const cl_uchar tunetargetdifficulty = 60;
   const std::string tuneidentity = "AAABBBCCCDDDEEEFFFGGGHHHIIIJJJKKKLLLMMMNNNOOOPPPQQQRRRSSSTTTUUUVVVWWWXXXYYYZZZAAABBBCCCDDDEEEFFFGGG";
   const size_t identity_length = tuneidentity.size();
+  const std::vector<uint32_t> tune_identitystate_buffer = IdentityState(tuneidentity).toKernelBuffer();
 
 
   cl::Context context({ *device });
-  cl::Program::Sources sources;
-  sources.push_back({ KERNEL_CODE, strlen(KERNEL_CODE) });
-  cl::Program program(context, sources);
 
-  if (program.build({ *device }, build_opts) != CL_SUCCESS) {
-    std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(*device) << std::endl;
-    exit(1);
-  }
+  // returns false if the variant cannot be built for the device, which is only allowed
+  // for the variants that are tried in addition to the base variant
+  auto build_kernel = [&](const TunedParameters& variant, bool required, cl::Kernel* kernel) -> bool {
+    const std::string tune_build_opts = std::string(build_opts)
+      + variant.getBuildOptions()
+      + KernelGenerator::getBuildOptions(identity_length, TSUtil::decimalLength(tunestartcounter));
 
-  cl::Kernel kernel(program, KERNEL_NAME);
+    const std::string source = KernelGenerator::getSource(KERNEL_CODE, identity_length, TSUtil::decimalLength(tunestartcounter));
+    cl::Program::Sources sources;
+    sources.push_back({ source.c_str(), source.size() });
+    cl::Program program(context, sources);
 
-  size_t max_local_worksize = 0;
-  kernel.getWorkGroupInfo<size_t>(*device, CL_KERNEL_WORK_GROUP_SIZE, &max_local_worksize);
-  max_local_worksize = std::min(max_local_worksize, device->getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0]);
+    if (program.build({ *device }, tune_build_opts.c_str()) != CL_SUCCESS) {
+      if (required) {
+        std::cout << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(*device) << std::endl;
+        exit(1);
+      }
+      return false;
+    }
+
+    *kernel = cl::Kernel(program, KernelGenerator::KERNEL_NAME);
+    return true;
+  };
+
+  auto max_local_worksize_of = [&](cl::Kernel& kernel) -> size_t {
+    size_t max_local_worksize = 0;
+    kernel.getWorkGroupInfo<size_t>(*device, CL_KERNEL_WORK_GROUP_SIZE, &max_local_worksize);
+    return std::min(max_local_worksize, device->getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[0]);
+  };
+
+  cl::Kernel kernel;
+  build_kernel(result, true, &kernel);
+  const size_t max_local_worksize = max_local_worksize_of(kernel);
 
 
   cl::CommandQueue command_queue(context, *device);
 
 
   const size_t max_global_work_size = MAX_GLOBALLOCAL_RATIO * max_local_worksize;
-  const size_t size_results = max_global_work_size * sizeof(uint8_t);
 
-  cl::Buffer tune_d_results(context, CL_MEM_WRITE_ONLY, size_results);
-  cl::Buffer tune_d_identity(context, CL_MEM_READ_ONLY, tuneidentity.size());
-  uint8_t* tune_h_results = new uint8_t[max_global_work_size]();
-  command_queue.enqueueWriteBuffer(tune_d_results, CL_TRUE, 0, size_results, tune_h_results);
-  command_queue.enqueueWriteBuffer(tune_d_identity, CL_TRUE, 0, identity_length, tuneidentity.c_str());
+  const size_t size_identitystate = tune_identitystate_buffer.size() * sizeof(uint32_t);
+
+  // the tune target is out of reach, so there will be no hits
+  cl::Buffer tune_d_hitcount(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+  cl::Buffer tune_d_hits(context, CL_MEM_WRITE_ONLY, MAX_HITS * sizeof(HitRecord));
+  cl::Buffer tune_d_identitystate(context, CL_MEM_READ_ONLY, size_identitystate);
+  cl_uint tune_h_hitcount = 0;
+  command_queue.enqueueWriteBuffer(tune_d_hitcount, CL_TRUE, 0, sizeof(cl_uint), &tune_h_hitcount);
+  // the tune kernels are never aborted, so they never write their progress
+  cl::Buffer tune_d_abortword(context, CL_MEM_READ_ONLY, sizeof(cl_uint));
+  cl::Buffer tune_d_progress(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint));
+  // the histogram of the tune kernels is never read
+  cl::Buffer tune_d_histogram(context, CL_MEM_READ_WRITE, 2 * DifficultyHistogram::BINS * sizeof(cl_uint));
+  command_queue.enqueueWriteBuffer(tune_d_abortword, CL_TRUE, 0, sizeof(cl_uint), &tune_h_hitcount);
+  command_queue.enqueueWriteBuffer(tune_d_identitystate, CL_TRUE, 0, size_identitystate, tune_identitystate_buffer.data());
 
 
 
   std::cout << "  ";
-  const size_t start_local_worksize = max_local_worksize > 128 ? 16 : 1;
-  const size_t end_local_worksize = max_local_worksize;
+  const size_t start_local_worksize = cpukernel ? 1 : max_local_worksize > 128 ? 16 : 1;
+  const size_t end_local_worksize = cpukernel ? 1 : max_local_worksize;
   const size_t repetitions = 30;
   const size_t warmup_runs = 5;
   const size_t max_time_per_kernel_ms = 150;
 
-  for (size_t localsize = start_local_worksize;
-    localsize <= end_local_worksize;
-    localsize *= 2) {
-    size_t globalsize = localsize;
+  auto enqueue_tune_kernel = [&](cl::Kernel& kernel, size_t iterations, size_t globalsize, size_t localsize) {
+    cl_int err;
+    err = kernel.setArg(0, tunestartcounter);
+    err |= kernel.setArg(1, (cl_uint)iterations);
+    err |= kernel.setArg(2, tunetargetdifficulty);
+    err |= kernel.setArg(3, tune_d_identitystate);
+    err |= kernel.setArg(4, tune_d_hitcount);
+    err |= kernel.setArg(5, tune_d_hits);
+    err |= kernel.setArg(6, tune_d_abortword);
+    err |= kernel.setArg(7, tune_d_progress);
+    err |= kernel.setArg(8, tune_d_histogram);
+    err |= kernel.setArg(9, sizeof(cl_mem), NULL);
+
+    if (err != CL_SUCCESS) {
+      std::cout << "A critical error occurred while setting kernel arguments." << std::endl;
+      exit(-1);
+    }
+
+    err = command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalsize), cl::NDRange(localsize));
+    if (err != CL_SUCCESS) {
+      std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
+      exit(-1);
+    }
+  };
+
+  // tries increasing global work sizes for a fixed local work size
+  // the time is normalized to the number of hashed counters, since
+  // every work item hashes chains*vectorsize*DIGIT_BATCH counters per iteration
+  // (the CPU kernel is only timed with one work item per compute unit)
+  auto sweep_global_worksizes = [&](cl::Kernel& kernel, const TunedParameters& variant, size_t localsize) {
+    size_t globalsize = cpukernel ? compute_units : localsize;
+    const size_t last_globalsize = cpukernel ? compute_units : max_global_work_size;
     duration<uint64_t, std::nano> time = steady_clock::duration::zero();
-    while (globalsize <= max_global_work_size && duration_cast<milliseconds>(time / repetitions).count() < max_time_per_kernel_ms) {
+    while (globalsize <= last_globalsize && duration_cast<milliseconds>(time / repetitions).count() < (int64_t)max_time_per_kernel_ms) {
       time_point<high_resolution_clock> starttime;
 
       for (size_t q = 0; q < repetitions + warmup_runs; q++) {
@@ -305,48 +576,118 @@ std::pair<uint64_t, uint64_t> TSHasherContext::tune(cl::Device* device,
         if (q == warmup_runs) {
           starttime = high_resolution_clock::now();
         }
-        cl_int err;
-        err = kernel.setArg(0, tunestartcounter);
-        err |= kernel.setArg(1, (cl_uint)KERNEL_STD_ITERATIONS);
-        err |= kernel.setArg(2, tunetargetdifficulty);
-        err |= kernel.setArg(3, tune_d_identity);
-        err |= kernel.setArg(4, (cl_uint)identity_length);
-        err |= kernel.setArg(5, tune_d_results);
-
-        if (err != CL_SUCCESS) {
-          std::cout << "A critical error occurred while setting kernel arguments." << std::endl;
-          exit(-1);
-        }
-
-        err = command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(globalsize), cl::NDRange(localsize));
-        if (err != CL_SUCCESS) {
-          std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
-          exit(-1);
-        }
-        err = command_queue.finish();
-        err = command_queue.enqueueReadBuffer(tune_d_results, CL_TRUE, 0, globalsize * sizeof(uint8_t), tune_h_results);
+        enqueue_tune_kernel(kernel, KERNEL_STD_ITERATIONS, globalsize, localsize);
+        command_queue.finish();
+        command_queue.enqueueReadBuffer(tune_d_hitcount, CL_TRUE, 0, sizeof(cl_uint), &tune_h_hitcount);
       }
 
       time = high_resolution_clock::now() - starttime;
       auto time_ns = duration_cast<nanoseconds>(time).count();
-      uint64_t time_norm = time_ns / globalsize;
+      const double time_norm = (double)time_ns / (globalsize * variant.chains * variant.vectorsize * DIGIT_BATCH);
 
       std::cout << ".";
 
-      if (duration_cast<milliseconds>(time / repetitions).count() < max_time_per_kernel_ms && time_norm < besttime) {
+      if (duration_cast<milliseconds>(time / repetitions).count() < (int64_t)max_time_per_kernel_ms && time_norm < besttime) {
         besttime = time_norm;
-        result.first = globalsize;
-        result.second = localsize;
+        // the variants are copies of the result, so they refer to the same device
+        result = variant;
+        result.globalworksize = globalsize;
+        result.localworksize = localsize;
       }
       globalsize *= 2;
     }
+  };
+
+  // first, we find the best work sizes for the base variant
+  for (size_t localsize = start_local_worksize;
+    localsize <= end_local_worksize;
+    localsize *= 2) {
+    sweep_global_worksizes(kernel, result, localsize);
   }
 
-  TunedParameters tunedparams(devicename, deviceidentifier, result.second, result.first);
-  Config::tuned.insert(std::make_pair(deviceidentifier, tunedparams));
+  // then, we search the space of kernel variants one dimension after the other,
+  // always starting from the best variant so far, with the local work size found above
+  // (variants that cannot be built or cannot run this local work size are skipped)
+  const size_t best_local_worksize = result.localworksize;
+  auto try_variant = [&](const TunedParameters& variant) {
+    cl::Kernel variantkernel;
+    if (!build_kernel(variant, false, &variantkernel)) { return; }
+    if (max_local_worksize_of(variantkernel) < best_local_worksize) { return; }
+    sweep_global_worksizes(variantkernel, variant, best_local_worksize);
+  };
+
+  for (cl_uint vectorsize = 1; vectorsize <= max_vector_size; vectorsize *= 2) {
+    if (vectorsize == result.vectorsize) { continue; }
+    TunedParameters variant = result;
+    variant.vectorsize = vectorsize;
+    try_variant(variant);
+  }
+  for (cl_uint chains = 2; chains <= MAX_CHAINS; chains *= 2) {
+    TunedParameters variant = result;
+    variant.chains = chains;
+    try_variant(variant);
+  }
+  for (cl_uint unroll = 2; unroll <= MAX_ITERATION_UNROLL; unroll *= 2) {
+    TunedParameters variant = result;
+    variant.unroll = unroll;
+    try_variant(variant);
+  }
+  {
+    TunedParameters variant = result;
+    variant.bitselect = 1 - result.bitselect;
+    try_variant(variant);
+  }
+  {
+    TunedParameters variant = result;
+    variant.decadedeltas = 1 - result.decadedeltas;
+    try_variant(variant);
+  }
+  for (const char* buildflags : VARIANT_BUILD_FLAGS) {
+    TunedParameters variant = result;
+    variant.buildflags = buildflags;
+    try_variant(variant);
+  }
+
+  // finally, we determine how many launches of the best variant are enqueued back to back
+  // before the host waits for their results, which saves synchronizations that are expensive
+  // on some platforms, the launches are short, such that the cost of a synchronization shows
+  // (more launches have to be notably faster, since they delay the results)
+  {
+    cl::Kernel bestkernel;
+    build_kernel(result, true, &bestkernel);
+    const size_t coalesce_iterations = KERNEL_STD_ITERATIONS / 16;
+    const size_t coalesce_launches = 4 * MAX_COALESCED_LAUNCHES;
+    double bestlaunchtime = std::numeric_limits<double>::max();
+    for (cl_uint coalesce = 1; coalesce <= MAX_COALESCED_LAUNCHES; coalesce *= 2) {
+      time_point<high_resolution_clock> starttime;
+      for (size_t q = 0; q < coalesce_launches + warmup_runs * coalesce; q++) {
+        if (q == warmup_runs * coalesce) {
+          starttime = high_resolution_clock::now();
+        }
+        enqueue_tune_kernel(bestkernel, coalesce_iterations, result.globalworksize, result.localworksize);
+        command_queue.flush();
+        if ((q + 1) % coalesce == 0) {
+          command_queue.finish();
+          command_queue.enqueueReadBuffer(tune_d_hitcount, CL_TRUE, 0, sizeof(cl_uint), &tune_h_hitcount);
+        }
+      }
+      const double launchtime = (double)duration_cast<nanoseconds>(high_resolution_clock::now() - starttime).count() / coalesce_launches;
+
+      std::cout << ".";
 
-  std::cout << std::endl << std::endl << "  Tuning found global_work_size=" << result.first
-    << ", local_work_size=" << result.second << " to be optimal." << std::endl;
+      if (launchtime < 0.99 * bestlaunchtime) {
+        bestlaunchtime = launchtime;
+        result.coalesce = coalesce;
+      }
+    }
+  }
+
+  Config::tuned[deviceidentifier] = result;
+
+  std::cout << std::endl << std::endl << "  Tuning found global_work_size=" << result.globalworksize
+    << ", local_work_size=" << result.localworksize
+    << ", " << result.getVariantDescription()
+    << ", " << result.coalesce << " launch(es) per readback to be optimal." << std::endl;
   return result;
 }
 
@@ -355,9 +696,27 @@ void TSHasherContext::compute() {
   std::vector<std::thread> threads;
   for (cl_uint device_id = 0; device_id < devices.size(); device_id++) {
     DeviceContext* dev_ctx = &dev_ctxs[device_id];
-    std::thread t([dev_ctx]() -> void { run_kernel_loop(dev_ctx); });
+    const bool persistent = options.persistent;
+    const bool batched = options.batch;
+    std::thread t([dev_ctx, persistent, batched]() -> void {
+      if (batched) { run_batch_loop(dev_ctx); }
+      else if (persistent) { run_persistent_loop(dev_ctx); }
+      else { run_kernel_loop(dev_ctx); }
+    });
     threads.push_back(std::move(t));
   }
+  if (cpu_ctx) {
+    // the cores of the threads feeding the OpenCL devices are the last ones to be used
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    CpuContext* cpu = cpu_ctx.get();
+    for (unsigned thread_id = 0; thread_id < cpu->threads; thread_id++) {
+      std::thread t([cpu, thread_id]() -> void {
+        run_cpu_loop(cpu, thread_id);
+      });
+      CpuContext::pinThread(t, (unsigned)((devices.size() + thread_id) % cores));
+      threads.push_back(std::move(t));
+    }
+  }
 
   // this loops until stopped
   TSHasherContext::printinfo(dev_ctxs);
@@ -365,6 +724,17 @@ void TSHasherContext::compute() {
   for (std::thread& t : threads) {
     t.join();
   }
+
+  // the ranges the stopped kernels have not reached have been given back by now
+  std::cout << std::endl << "===========================================================" << std::endl;
+  if (options.batch) {
+    for (const BatchIdentity& member : batch) {
+      std::cout << std::endl << "Stopped " << member.nickname << " at counter: " << member.startcounter << std::endl;
+    }
+  }
+  else {
+    std::cout << std::endl << "Stopped at counter: " << dispenser.next() << std::endl;
+  }
 }
 
 
@@ -398,7 +768,7 @@ std::string TSHasherContext::getFormattedDuration(double seconds) {
   return out;
 }
 
-void TSHasherContext::printinfo(const std::vector<DeviceContext>& dev_ctxs) {
+void TSHasherContext::printinfo(const std::deque<DeviceContext>& dev_ctxs) {
   do {
     clearConsole();
     Table overalltable({ "Overview","" }, true);
@@ -408,6 +778,8 @@ void TSHasherContext::printinfo(const std::vector<DeviceContext>& dev_ctxs) {
     auto runningtime_ns = duration_cast<nanoseconds>(currenttime - starttime).count();
     const double runningtime = runningtime_ns / 1e9;
     overalltable.addRow({ "Running time: ", getFormattedDuration(runningtime) });
+    overalltable.addRow({ "Counter layout", options.layout == LAYOUT_INTERLEAVED ? "interleaved" : "contiguous" });
+    overalltable.addRow({ "Kernel mode", options.persistent ? "persistent" : "one launch per range" });
 
     uint64_t computed_hashes_total = 0;
     double currentspeed_total = 0;
@@ -425,6 +797,7 @@ void TSHasherContext::printinfo(const std::vector<DeviceContext>& dev_ctxs) {
 
 
       devtable.addRow({ "Local/Global work size", std::to_string(dev_ctx.local_work_size) + "/" + std::to_string(dev_ctx.global_work_size) });
+      devtable.addRow({ "Kernel variant", dev_ctx.kernelvariant });
 
 
       const uint64_t computed_hashes_device = dev_ctx.completediterations_total;
@@ -437,51 +810,105 @@ void TSHasherContext::printinfo(const std::vector<DeviceContext>& dev_ctxs) {
       devtable.addRow({ "Current speed", getFormattedDouble(currentspeed_device) + "Hash/s" });
       devtable.addRow({ "Average speed", getFormattedDouble(avgspeed_device) + "Hash/s" });
       devtable.addRow({ "Scheduling", std::to_string(dev_ctx.completed_kernels / runningtime) + " Kernels/s" });
+      if (!options.persistent && !options.batch) {
+        // the kernels are queued back to back, so the device should hardly idle between them
+        devtable.addRow({ "Idle between kernels", std::to_string(dev_ctx.getAvgIdleGap() * 1e6) + " us" });
+        devtable.addRow({ "Launches per readback", std::to_string(dev_ctx.groups[0].launches.size()) });
+      }
+      if (!options.persistent) {
+        devtable.addRow({ "Iterations per launch", std::to_string(dev_ctx.launchiterations) });
+      }
+      if (options.histogram) {
+        // the histogram is counted by the kernels, so it measures the speed independently
+        const DifficultyHistogram& histogram = dev_ctx.histogram;
+        std::string bins;
+        for (cl_uint b = 0; b < DifficultyHistogram::BINS; b++) {
+          bins += (b > 0 ? "/" : "") + std::to_string(histogram.bins[b]);
+        }
+        devtable.addRow({ "Difficulty 8/16/24/32+", bins });
+        devtable.addRow({ "Histogram speed", getFormattedDouble(histogram.getHashes() / runningtime) + "Hash/s" });
+        devtable.addRow({ "Histogram check", histogram.isPlausible(computed_hashes_device) ? "OK" : "MISMATCH (missing work or wrong digests)" });
+      }
+      if (options.audit) {
+        devtable.addRow({ "Audited ranges", std::to_string(dev_ctx.audited_items)
+          + (dev_ctx.failed_audits == 0 ? " (all verified)" : " (" + std::to_string(dev_ctx.failed_audits) + " FAILED)") });
+      }
 
       devicetables.push_back(std::move(devtable));
     }
 
+    if (cpu_ctx) {
+      if (cpu_ctx->bestdifficulty > global_bestdifficulty) {
+        global_bestdifficulty = cpu_ctx->bestdifficulty;
+        global_bestdifficulty_counter = cpu_ctx->bestdifficulty_counter;
+      }
+
+      Table cputable({ "Device " + cpu_ctx->device_name + "[native]", "" }, true);
+      cputable.addRow({ "Threads", std::to_string(cpu_ctx->threads) });
+      cputable.addRow({ "Kernel variant", cpu_ctx->getVariantDescription() });
+
+      const uint64_t computed_hashes_cpu = cpu_ctx->completediterations_total;
+      computed_hashes_total += computed_hashes_cpu;
+
+      const double currentspeed_cpu = cpu_ctx->getAvgSpeed();
+      currentspeed_total += currentspeed_cpu;
+
+      cputable.addRow({ "Current speed", getFormattedDouble(currentspeed_cpu) + "Hash/s" });
+      cputable.addRow({ "Average speed", getFormattedDouble(computed_hashes_cpu / runningtime) + "Hash/s" });
+      cputable.addRow({ "Scheduling", std::to_string(cpu_ctx->completed_ranges / runningtime) + " Ranges/s" });
+
+      devicetables.push_back(std::move(cputable));
+    }
+
     const double unitspersecond_global = computed_hashes_total / runningtime;
 
     overalltable.addRow({ "Current speed [total]", getFormattedDouble(currentspeed_total) + "Hash/s" });
     overalltable.addRow({ "Average speed [total]", getFormattedDouble(unitspersecond_global) + "Hash/s" });
 
 
-    const bool slowphase = TSUtil::isSlowPhase(identity.size(), startcounter);
-    if (slowphase) {
-      overalltable.addRow({ "Estimated time until slow phase", "0 (IN SLOW PHASE!!!)" });
+    // the estimates are about a single identity, every identity of a batch gets a row instead
+    bool slowphase = false;
+    if (options.batch) {
+      devicetables.insert(devicetables.begin(), getBatchTable());
     }
     else {
-      auto its_until_slow = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
-      auto time_until_slow = its_until_slow / currentspeed_total;
-      overalltable.addRow({ "Estimated time until slow phase", getFormattedDuration(time_until_slow) });
-    }
-
-    uint64_t nextlevel = std::max((uint64_t)(global_bestdifficulty + 1ull),
-      (uint64_t)MIN_TARGET_DIFFICULTY);
+      const uint64_t startcounter = dispenser.next();
+      slowphase = TSUtil::isSlowPhase(identity.size(), startcounter);
+      if (slowphase) {
+        overalltable.addRow({ "Estimated time until slow phase", "0 (IN SLOW PHASE!!!)" });
+      }
+      else {
+        auto its_until_slow = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
+        auto time_until_slow = its_until_slow / currentspeed_total;
+        overalltable.addRow({ "Estimated time until slow phase", getFormattedDuration(time_until_slow) });
+      }
 
-    // we want to estimate the remaining time for the next level,
-    // accounting for the slow phase
-    uint64_t nextlevel_estits = ((uint64_t)1 << nextlevel);
-    uint64_t remaining_fastits = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
-    uint64_t nextlevel_estits_adjusted = slowphase ? nextlevel_estits : (2 * nextlevel_estits - std::min(remaining_fastits, nextlevel_estits));
-    double nextlevel_esttime_seconds = nextlevel_estits_adjusted / currentspeed_total;
+      uint64_t nextlevel = std::max((uint64_t)(global_bestdifficulty + 1ull),
+        (uint64_t)MIN_TARGET_DIFFICULTY);
+
+      // we want to estimate the remaining time for the next level,
+      // accounting for the slow phase
+      uint64_t nextlevel_estits = ((uint64_t)1 << nextlevel);
+      uint64_t remaining_fastits = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
+      uint64_t nextlevel_estits_adjusted = slowphase ? nextlevel_estits : (2 * nextlevel_estits - std::min(remaining_fastits, nextlevel_estits));
+      double nextlevel_esttime_seconds = nextlevel_estits_adjusted / currentspeed_total;
+
+      if (nextlevel_esttime_seconds > 60 && global_bestdifficulty + 1 < MIN_TARGET_DIFFICULTY) {
+        MIN_TARGET_DIFFICULTY -= (uint8_t)std::ceil(std::log2(nextlevel_esttime_seconds / 60));
+        MIN_TARGET_DIFFICULTY = std::max((uint8_t)32, MIN_TARGET_DIFFICULTY);
+        // we need to recompute the time estimations
+        nextlevel = std::max((uint64_t)(global_bestdifficulty + 1ull), (uint64_t)MIN_TARGET_DIFFICULTY);
+        nextlevel_estits = ((uint64_t)1 << nextlevel);
+        remaining_fastits = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
+        nextlevel_estits_adjusted = slowphase ? nextlevel_estits : (2 * nextlevel_estits - std::min(remaining_fastits, nextlevel_estits));
+        nextlevel_esttime_seconds = nextlevel_estits_adjusted / currentspeed_total;
+      }
+      overalltable.addRow({ "Security level" ,
+        std::to_string((uint32_t)global_bestdifficulty) + " (with counter=" + std::to_string(global_bestdifficulty_counter) + ")" });
 
-    if (nextlevel_esttime_seconds > 60 && global_bestdifficulty + 1 < MIN_TARGET_DIFFICULTY) {
-      MIN_TARGET_DIFFICULTY -= (uint8_t)std::ceil(std::log2(nextlevel_esttime_seconds / 60));
-      MIN_TARGET_DIFFICULTY = std::max((uint8_t)32, MIN_TARGET_DIFFICULTY);
-      // we need to recompute the time estimations
-      nextlevel = std::max((uint64_t)(global_bestdifficulty + 1ull), (uint64_t)MIN_TARGET_DIFFICULTY);
-      nextlevel_estits = ((uint64_t)1 << nextlevel);
-      remaining_fastits = TSUtil::itsUntilSlowPhase(identity.size(), startcounter);
-      nextlevel_estits_adjusted = slowphase ? nextlevel_estits : (2 * nextlevel_estits - std::min(remaining_fastits, nextlevel_estits));
-      nextlevel_esttime_seconds = nextlevel_estits_adjusted / currentspeed_total;
+      overalltable.addRow({ "Estimated time until level " + std::to_string(nextlevel), getFormattedDuration(nextlevel_esttime_seconds) });
+      overalltable.addRow({ "Current counter", std::to_string(startcounter) });
     }
-    overalltable.addRow({ "Security level" ,
-      std::to_string((uint32_t)global_bestdifficulty) + " (with counter=" + std::to_string(global_bestdifficulty_counter) + ")" });
-
-    overalltable.addRow({ "Estimated time until level " + std::to_string(nextlevel), getFormattedDuration(nextlevel_esttime_seconds) });
-    overalltable.addRow({ "Current counter", std::to_string(startcounter) });
 
 
     // we start to print
@@ -497,39 +924,409 @@ void TSHasherContext::printinfo(const std::vector<DeviceContext>& dev_ctxs) {
     std::cout << std::endl << "(press Ctrl+C to stop and save progress)" << std::endl;
   } while (timerkiller.running() && timerkiller.wait_for(std::chrono::milliseconds(1000)));
 
-  // we wait for all scheduled kernels to finish
+  // we let the running kernels stop early and wait for them
+  aborted = true;
+  const cl_uint one = 1;
+  for (auto& dev : dev_ctxs) {
+    if (dev.abort_queue.enqueueWriteBuffer(dev.d_abortword, CL_TRUE, 0, sizeof(cl_uint), &one) != CL_SUCCESS) {
+      std::cout << "A critical error occurred while aborting the kernels." << std::endl;
+      exit(-1);
+    }
+  }
   for (auto& dev : dev_ctxs) {
     dev.command_queue.finish();
   }
-  std::cout << std::endl << "===========================================================" << std::endl;
-  std::cout << std::endl << "Stopped at counter: " << startcounter << std::endl;
+}
+
+Table TSHasherContext::getBatchTable() {
+  Table batchtable({ "Nickname", "Weight", "Current counter", "Security level", "Share" }, true);
+  uint64_t scheduledcounters_total = 0;
+  for (const BatchIdentity& member : batch) {
+    scheduledcounters_total += member.scheduledcounters;
+  }
+  for (const BatchIdentity& member : batch) {
+    const double share = scheduledcounters_total > 0 ? 100.0 * member.scheduledcounters / scheduledcounters_total : 0;
+    const bool slowphase = TSUtil::isSlowPhase(member.identity.size(), member.startcounter);
+    batchtable.addRow({ member.nickname,
+      std::to_string(member.weight),
+      std::to_string(member.startcounter) + (slowphase ? " (slow phase)" : ""),
+      std::to_string((uint32_t)member.bestdifficulty) + " (with counter=" + std::to_string(member.bestdifficulty_counter) + ")",
+      std::to_string((uint32_t)std::round(share)) + " %" });
+  }
+  return batchtable;
 }
 
 
 void TSHasherContext::run_kernel_loop(DeviceContext* dev_ctx) {
+  // the results of the launches are read by a second thread, such that the device
+  // always has queued kernels, the groups of the launches circulate between both threads
+  // the launches of a group are enqueued back to back and the host only waits once for all their results
+  std::vector<LaunchGroup>& groups = dev_ctx->groups;
+  SpscQueue<LaunchGroup*> launched(groups.size());
+  SpscQueue<LaunchGroup*> available(groups.size());
+  for (LaunchGroup& group : groups) {
+    available.push(&group);
+  }
+  std::thread consumer([dev_ctx, &launched, &available]() -> void {
+    LaunchGroup* group;
+    while (launched.pop(&group)) {
+      finishGroup(dev_ctx, group);
+      available.push(group);
+    }
+  });
+
+  // the results are read right behind the last launch of a group, before the next group starts
+  auto enqueueResults = [dev_ctx](LaunchGroup* group) -> void {
+    readResults(dev_ctx, group, CL_FALSE);
+    cl_int err = dev_ctx->command_queue.enqueueMarkerWithWaitList(NULL, &group->resultevent);
+    err |= dev_ctx->command_queue.flush();
+    if (err != CL_SUCCESS) {
+      std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
+      exit(-1);
+    }
+  };
+
+  LaunchGroup* group = nullptr;
   while (dev_ctx->tshasherctx->timerkiller.running()) {
-    const size_t identity_length = dev_ctx->identitystring.size();
-    cl::Kernel& kernel = TSUtil::isSlowPhase(identity_length, dev_ctx->tshasherctx->startcounter) ? dev_ctx->kernel2 : dev_ctx->kernel;
-
-    dev_ctx->tshasherctx->startcounter_mutex.lock();
-    auto dev_startcounter = dev_ctx->tshasherctx->startcounter;
-    auto global_max_iterations = std::min((uint64_t)dev_ctx->global_work_size * KERNEL_STD_ITERATIONS, TSUtil::itsConstantCounterLength(dev_startcounter));
-    const uint64_t iterations = global_max_iterations / dev_ctx->global_work_size;
-    if (iterations == 0) {
-      // if there are too few iterations until the counter length increases, we just skip these
-      dev_ctx->tshasherctx->startcounter += global_max_iterations;
-      dev_ctx->tshasherctx->startcounter_mutex.unlock();
+    if (group == nullptr) {
+      available.pop(&group);
+      group->launched = 0;
+    }
+    // the kernel is specialized for the counter length, we look it up
+    // before taking the lock, since this may have to wait for its build
+    const uint8_t counterlength = TSUtil::decimalLength(dev_ctx->tshasherctx->dispenser.next());
+    if (launchRange(dev_ctx, &group->launches[group->launched], dev_ctx->kernelgenerator.getKernel(counterlength), counterlength)) {
+      group->launched++;
+    }
+    if (group->launched == group->launches.size()) {
+      enqueueResults(group);
+      launched.push(group);
+      group = nullptr;
+    }
+  }
+  // the launches of an incomplete group are evaluated as well
+  if (group != nullptr && group->launched > 0) {
+    enqueueResults(group);
+    launched.push(group);
+  }
+  launched.close();
+  consumer.join();
+}
+
+bool TSHasherContext::launchRange(DeviceContext* dev_ctx, LaunchSlot* slot, cl::Kernel kernel, uint8_t counterlength) {
+  // every work item hashes chains*vector_size*digit_batch counters per iteration
+  const uint64_t counters_per_item = dev_ctx->getCountersPerItem();
+  const uint64_t counters_per_iteration = dev_ctx->global_work_size * counters_per_item;
+
+  // the ranges of the work items have to start at a multiple of the digit batch,
+  // which the dispenser ensures for all ranges (see RangeDispenser)
+  // the range consists of whole iterations of all work items, unless the counters until
+  // the counter length increases do not suffice for one, then they are all taken
+  uint64_t dev_startcounter;
+  uint64_t rangecounters;
+  const uint64_t launchiterations = dev_ctx->adaptLaunchIterations(dev_ctx->tshasherctx->options.kerneltime / 1e3, MAX_LAUNCH_ITERATIONS);
+  auto count = [counters_per_iteration, launchiterations](uint64_t available) -> uint64_t {
+    if (available < counters_per_iteration) { return available; }
+    return std::min(available - available % counters_per_iteration, counters_per_iteration * launchiterations);
+  };
+  if (!dev_ctx->tshasherctx->dispenser.take(slot->holder, counterlength, count, &dev_startcounter, &rangecounters)) {
+    // another device has reached the next counter length in the meantime
+    return false;
+  }
+
+  uint64_t iterations = rangecounters / counters_per_iteration;
+  size_t global_work_size = dev_ctx->global_work_size;
+  cl::NDRange local_work_size(dev_ctx->local_work_size);
+  uint64_t hostcounters = 0;
+  if (iterations == 0) {
+    // too few counters remain until the counter length increases for a single iteration
+    // of all work items, so a reduced grid hashes them with one iteration per work item
+    // (the runtime chooses the local work size, as the grid need not be a multiple of ours)
+    // the last few counters, which do not fill a work item, are hashed on the host
+    iterations = 1;
+    global_work_size = (size_t)(rangecounters / counters_per_item);
+    local_work_size = cl::NullRange;
+    hostcounters = rangecounters % counters_per_item;
+  }
+  const uint64_t kernelcounters = global_work_size * counters_per_item * iterations;
+
+  slot->startcounter = dev_startcounter;
+  slot->iterations = iterations;
+  slot->global_work_size = global_work_size;
+  slot->scheduledcounters = kernelcounters + hostcounters;
+  slot->audited = false;
+
+  if (global_work_size == 0) {
+    // not even a single work item can be filled
+    slot->hostbest = hashOnHost(dev_ctx->identitystring, dev_startcounter, hostcounters);
+    return true;
+  }
+
+  cl_int err;
+  err = kernel.setArg(0, (cl_ulong)dev_startcounter);
+  err |= kernel.setArg(1, (cl_uint)iterations);
+  const uint8_t bestdifficulty = std::max(dev_ctx->tshasherctx->global_bestdifficulty, dev_ctx->bestdifficulty);
+  const uint8_t targetdifficulty = std::max(dev_ctx->tshasherctx->MIN_TARGET_DIFFICULTY, (uint8_t)(1 + bestdifficulty));
+  err |= kernel.setArg(2, (cl_uchar)targetdifficulty);
+  err |= kernel.setArg(3, dev_ctx->d_identitystate);
+  err |= kernel.setArg(4, slot->d_hitcount);
+  err |= kernel.setArg(5, slot->d_hits);
+  err |= kernel.setArg(6, dev_ctx->d_abortword);
+  err |= kernel.setArg(7, slot->d_progress);
+  err |= kernel.setArg(8, slot->d_histogram);
+  err |= kernel.setArg(9, slot->d_checksums);
+
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while " << "setting kernel arguments." << std::endl;
+    exit(-1);
+  }
+
+  dev_ctx->measureTime();
+
+
+  dev_ctx->lastscheduled_startcounter = dev_startcounter;
+  dev_ctx->schedulediterations_total += kernelcounters + hostcounters;
+  dev_ctx->lastschedulediterations_total = kernelcounters + hostcounters;
+
+
+  err = dev_ctx->command_queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+    cl::NDRange(global_work_size),
+    local_work_size,
+    NULL, &slot->kernelevent);
+  err |= dev_ctx->command_queue.flush();
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
+    exit(-1);
+  }
+
+  // the host hashes its counters while the kernel is running, the checksum of an audited work item
+  // is recomputed by finishRange, such that the kernels are enqueued without delay
+  slot->audited = isAuditDue(dev_ctx);
+  slot->audititem = slot->audited ? dev_ctx->auditrng() % global_work_size : 0;
+  slot->hostbest = hashOnHost(dev_ctx->identitystring, dev_startcounter + kernelcounters, hostcounters);
+  return true;
+}
+
+void TSHasherContext::finishGroup(DeviceContext* dev_ctx, LaunchGroup* group) {
+  // this is a workaround to reduce the cpu load for implementations (as NVIDIA's) doing busy waiting
+  // we poll the results instead, which does not delay the device as long as another group is queued
+  #ifdef BUSYWAITING_WORKAROUND
+  while (group->resultevent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() > CL_COMPLETE) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  #endif
+  if (group->resultevent.wait() != CL_SUCCESS) {
+    std::cout << "A critical error occurred while reading the kernel results." << std::endl;
+    exit(-1);
+  }
+
+  for (size_t k = 0; k < group->launched; k++) {
+    finishRange(dev_ctx, &group->launches[k]);
+  }
+  releaseResults(dev_ctx, group);
+}
+
+void TSHasherContext::finishRange(DeviceContext* dev_ctx, LaunchSlot* slot) {
+  updateBest(dev_ctx, slot->hostbest);
+  if (slot->global_work_size == 0) {
+    // the range has been hashed on the host entirely
+    dev_ctx->completediterations_total += slot->scheduledcounters;
+    dev_ctx->tshasherctx->dispenser.release(slot->holder);
+    return;
+  }
+
+  // the device idles between the end of the previous kernel and the start of this one
+  // (only profiled by the command queue of run_kernel_loop)
+  cl_ulong kernelstart = 0;
+  cl_ulong kernelend = 0;
+  if (slot->kernelevent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelstart) == CL_SUCCESS
+    && slot->kernelevent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelend) == CL_SUCCESS) {
+    if (dev_ctx->lastkernelend != 0) {
+      dev_ctx->idletime_ns += kernelstart > dev_ctx->lastkernelend ? kernelstart - dev_ctx->lastkernelend : 0;
+      dev_ctx->idlegaps++;
+    }
+    dev_ctx->lastkernelend = kernelend;
+  }
+
+  // the checksums of aborted work items are incomplete
+  if (slot->audited && !dev_ctx->tshasherctx->aborted) {
+    const uint32_t auditchecksum = getItemChecksum(dev_ctx, dev_ctx->identitystring, slot->startcounter,
+      slot->audititem, slot->global_work_size, slot->iterations);
+    verifyChecksum(dev_ctx, *slot->h_checksum, auditchecksum);
+  }
+
+  uint64_t completedcounters = slot->scheduledcounters;
+  if (dev_ctx->tshasherctx->aborted) {
+    // the kernel has been stopped, we make sure that the counters
+    // it has not reached are hashed again after a restart
+    // if we cannot tell how far the kernel got, it has to be hashed again entirely
+    uint64_t firstunhashed = slot->startcounter;
+    uint64_t hashed = 0;
+    if (readProgress(dev_ctx, slot, slot->global_work_size)) {
+      firstunhashed = getFirstUnhashedCounter(dev_ctx, slot, slot->startcounter, 0, slot->global_work_size, slot->iterations, &hashed);
+    }
+    completedcounters = hashed;
+    // only the range of this launch is given back, the counters after it may belong to other devices
+    const uint64_t kernelend = slot->startcounter + slot->global_work_size * dev_ctx->getCountersPerItem() * slot->iterations;
+    if (firstunhashed < kernelend) {
+      dev_ctx->tshasherctx->dispenser.giveBack(firstunhashed, kernelend - firstunhashed);
+    }
+  }
+  read_kernel_result(dev_ctx, slot, completedcounters);
+  if (slot->droppedhits > 0) {
+    // the best counter may be among the dropped hits
+    updateBest(dev_ctx, hashOnHost(dev_ctx->identitystring, slot->startcounter,
+      slot->global_work_size * dev_ctx->getCountersPerItem() * slot->iterations));
+  }
+  dev_ctx->tshasherctx->dispenser.release(slot->holder);
+}
+
+std::pair<uint8_t, uint64_t> TSHasherContext::hashOnHost(const std::string& identity, uint64_t rangestart, uint64_t rangecounters) {
+  std::pair<uint8_t, uint64_t> best(0, rangestart);
+  for (uint64_t counter = rangestart; counter < rangestart + rangecounters; counter++) {
+    const uint8_t difficulty = TSUtil::getDifficulty(identity, counter);
+    if (difficulty > best.first) {
+      best = std::make_pair(difficulty, counter);
+    }
+  }
+  return best;
+}
+
+void TSHasherContext::updateBest(DeviceContext* dev_ctx, std::pair<uint8_t, uint64_t> best) {
+  if (best.first > dev_ctx->bestdifficulty) {
+    dev_ctx->bestdifficulty = best.first;
+    dev_ctx->bestdifficulty_counter = best.second;
+  }
+}
+
+std::pair<uint64_t, uint64_t> TSHasherContext::getBatchProgress(size_t index) {
+  std::lock_guard<std::mutex> lock(startcounter_mutex);
+  const BatchIdentity& member = batch[index];
+  return std::make_pair(member.getFirstUnfinished(), (uint64_t)member.bestdifficulty_counter);
+}
+
+void TSHasherContext::updateBatchBest(TSHasherContext* tshasherctx, size_t index, std::pair<uint8_t, uint64_t> best) {
+  // the identities of a batch are shared by all devices
+  std::lock_guard<std::mutex> lock(tshasherctx->startcounter_mutex);
+  BatchIdentity& member = tshasherctx->batch[index];
+  if (best.first > member.bestdifficulty) {
+    member.bestdifficulty = best.first;
+    member.bestdifficulty_counter = best.second;
+  }
+}
+
+bool TSHasherContext::readProgress(DeviceContext* dev_ctx, LaunchSlot* slot, size_t global_work_size) {
+  cl_int err = dev_ctx->command_queue.enqueueReadBuffer(slot->d_progress, CL_TRUE, 0,
+    global_work_size * sizeof(cl_uint), slot->h_progress.data());
+  return err == CL_SUCCESS;
+}
+
+uint64_t TSHasherContext::getFirstUnhashedCounter(DeviceContext* dev_ctx, const LaunchSlot* slot, uint64_t rangestart,
+  size_t firstitem, size_t items, uint64_t iterations, uint64_t* hashed) {
+  const uint64_t counters_per_item = dev_ctx->getCountersPerItem();
+
+  // the chains and lanes of a work item are equally far, so its first
+  // lane of its first chain holds its first counter that has not been hashed
+  uint64_t firstunhashed = UINT64_MAX;
+  for (size_t item = 0; item < items; item++) {
+    const uint64_t done = std::min((uint64_t)slot->h_progress[firstitem + item], iterations);
+    *hashed += done * counters_per_item;
+    if (done == iterations) { continue; }
+
+    uint64_t itemcounter;
+    if (dev_ctx->tshasherctx->options.layout == LAYOUT_INTERLEAVED) {
+      itemcounter = rangestart + item * counters_per_item + done * items * counters_per_item;
+    }
+    else {
+      itemcounter = rangestart + item * iterations * counters_per_item + done * dev_ctx->digit_batch;
+    }
+    firstunhashed = std::min(firstunhashed, itemcounter);
+  }
+  return firstunhashed;
+}
+
+bool TSHasherContext::publishLease(DeviceContext* dev_ctx, uint8_t counterlength, uint64_t lease_counters) {
+  TSHasherContext* tshasherctx = dev_ctx->tshasherctx;
+  WorkQueue* queue = &dev_ctx->workqueue;
+  if (queue->published >= WorkQueue::MAX_LEASES) {
+    return false;
+  }
+
+  // the program of the kernel is specialized for the counter length and the ranges
+  // of the work items have to start at a multiple of the digit batch
+  // if the counters until the counter length increases do not fill a lease,
+  // they are hashed by the range kernel once the kernel has completed
+  uint64_t leasestart;
+  uint64_t leasecounters;
+  auto count = [lease_counters](uint64_t available) -> uint64_t {
+    return available < lease_counters ? 0 : lease_counters;
+  };
+  if (!tshasherctx->dispenser.take(dev_ctx->leaseholder, counterlength, count, &leasestart, &leasecounters)) {
+    return false;
+  }
+
+  queue->leasestart[queue->published] = leasestart;
+  queue->published++;
+  dev_ctx->schedulediterations_total += lease_counters;
+  return true;
+}
+
+void TSHasherContext::run_persistent_loop(DeviceContext* dev_ctx) {
+  TSHasherContext* tshasherctx = dev_ctx->tshasherctx;
+  WorkQueue* queue = &dev_ctx->workqueue;
+  LaunchGroup* group = &dev_ctx->groups[0];
+  LaunchSlot* slot = &group->launches[0];
+  group->launched = 1;
+
+  // the grid is sized to the compute units, every work group hashes one chunk at a time
+  // and a lease keeps all groups busy for KERNEL_STD_ITERATIONS iterations
+  const size_t local_work_size = dev_ctx->local_work_size;
+  const size_t global_work_size = std::min(dev_ctx->global_work_size,
+    dev_ctx->max_compute_units * PERSISTENT_GROUPS_PER_COMPUTE_UNIT * local_work_size);
+  const uint64_t groups = global_work_size / local_work_size;
+  const uint64_t chunk_counters = local_work_size * dev_ctx->getCountersPerItem() * PERSISTENT_CHUNK_ITERATIONS;
+  const cl_uint lease_chunks = (cl_uint)std::max((uint64_t)1, groups * KERNEL_STD_ITERATIONS / PERSISTENT_CHUNK_ITERATIONS);
+  const uint64_t lease_counters = chunk_counters * lease_chunks;
+
+  while (tshasherctx->timerkiller.running()) {
+    const uint8_t counterlength = TSUtil::decimalLength(tshasherctx->dispenser.next());
+    cl::Kernel kernel = dev_ctx->kernelgenerator.getKernel(counterlength);
+
+    // the leases of a launch are all taken before it, the host cannot add leases to a running kernel
+    // (the queue is not in use, since the previous kernel has completed)
+    queue->published = 0;
+    while (queue->published < PERSISTENT_LAUNCH_LEASES && publishLease(dev_ctx, counterlength, lease_counters)) {}
+    if (queue->published == 0) {
+      // either another device has reached the next counter length in the meantime,
+      // or the counters until the next length do not fill a lease
+      if (TSUtil::decimalLength(tshasherctx->dispenser.next()) == counterlength
+        && launchRange(dev_ctx, slot, dev_ctx->kernelgenerator.getRangeKernel(counterlength), counterlength)) {
+        finishRange(dev_ctx, slot);
+      }
       continue;
     }
-    cl_int err;
-    err = kernel.setArg(0, (cl_ulong)dev_ctx->tshasherctx->startcounter);
-    err |= kernel.setArg(1, (cl_uint)iterations);
-    const uint8_t bestdifficulty = std::max(dev_ctx->tshasherctx->global_bestdifficulty, dev_ctx->bestdifficulty);
-    const uint8_t targetdifficulty = std::max(dev_ctx->tshasherctx->MIN_TARGET_DIFFICULTY, (uint8_t)(1 + bestdifficulty));
+
+    // the in-order queue completes both writes before the kernel starts
+    const cl_uint zero = 0;
+    cl_int err = dev_ctx->command_queue.enqueueWriteBuffer(dev_ctx->d_cursor, CL_TRUE, 0, sizeof(cl_uint), &zero);
+    err |= dev_ctx->command_queue.enqueueWriteBuffer(dev_ctx->d_workqueue, CL_TRUE, 0, sizeof(WorkQueue), queue);
+    if (err != CL_SUCCESS) {
+      std::cout << "A critical error occurred while writing the work queue." << std::endl;
+      exit(-1);
+    }
+
+    const uint8_t bestdifficulty = std::max(tshasherctx->global_bestdifficulty, dev_ctx->bestdifficulty);
+    const uint8_t targetdifficulty = std::max(tshasherctx->MIN_TARGET_DIFFICULTY, (uint8_t)(1 + bestdifficulty));
+    err = kernel.setArg(0, PERSISTENT_CHUNK_ITERATIONS);
+    err |= kernel.setArg(1, lease_chunks);
     err |= kernel.setArg(2, (cl_uchar)targetdifficulty);
-    err |= kernel.setArg(3, dev_ctx->d_identity);
-    err |= kernel.setArg(4, (cl_uint)identity_length);
-    err |= kernel.setArg(5, dev_ctx->d_results);
+    err |= kernel.setArg(3, dev_ctx->d_identitystate);
+    err |= kernel.setArg(4, dev_ctx->d_cursor);
+    err |= kernel.setArg(5, dev_ctx->d_workqueue);
+    err |= kernel.setArg(6, dev_ctx->d_abortword);
+    err |= kernel.setArg(7, slot->d_hitcount);
+    err |= kernel.setArg(8, slot->d_hits);
+    err |= kernel.setArg(9, slot->d_histogram);
 
     if (err != CL_SUCCESS) {
       std::cout << "A critical error occurred while " << "setting kernel arguments." << std::endl;
@@ -537,86 +1334,555 @@ void TSHasherContext::run_kernel_loop(DeviceContext* dev_ctx) {
     }
 
     dev_ctx->measureTime();
+    dev_ctx->lastscheduled_startcounter = queue->leasestart[0];
 
-
-    dev_ctx->lastscheduled_startcounter = dev_ctx->tshasherctx->startcounter;
-    dev_ctx->tshasherctx->startcounter += static_cast<uint64_t>(dev_ctx->global_work_size) * iterations;
-    dev_ctx->tshasherctx->startcounter_mutex.unlock();
-    dev_ctx->schedulediterations_total += static_cast<uint64_t>(dev_ctx->global_work_size) * iterations;
-    dev_ctx->lastschedulediterations_total = static_cast<uint64_t>(dev_ctx->global_work_size) * iterations;
-
-
+    cl::Event kernelevent;
     err = dev_ctx->command_queue.enqueueNDRangeKernel(kernel, cl::NullRange,
-      cl::NDRange(dev_ctx->global_work_size),
-      cl::NDRange(dev_ctx->local_work_size),
-      NULL);
+      cl::NDRange(global_work_size),
+      cl::NDRange(local_work_size),
+      NULL, &kernelevent);
     if (err != CL_SUCCESS) {
       std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
       exit(-1);
     }
+    dev_ctx->command_queue.flush();
+
+    // the kernel runs until it has claimed all chunks of its leases or is aborted,
+    // we poll it instead of waiting, as some implementations wait busily
+    while (kernelevent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() > CL_COMPLETE) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    dev_ctx->command_queue.finish();
+
+    // the chunks are claimed in order, so the claimed ones are exactly the hashed ones
+    cl_uint claimed = 0;
+    err = dev_ctx->command_queue.enqueueReadBuffer(dev_ctx->d_cursor, CL_TRUE, 0, sizeof(cl_uint), &claimed);
+    if (claimed < queue->published * lease_chunks) {
+      // the kernel has been aborted, we give the remaining chunks of its leases back,
+      // the leases need not be contiguous, since the other devices take ranges in between
+      const cl_uint firstlease = claimed / lease_chunks;
+      const uint64_t firstunhashed = queue->leasestart[firstlease] + (claimed % lease_chunks) * chunk_counters;
+      tshasherctx->dispenser.giveBack(firstunhashed, queue->leasestart[firstlease] + lease_counters - firstunhashed);
+      for (cl_uint lease = firstlease + 1; lease < queue->published; lease++) {
+        tshasherctx->dispenser.giveBack(queue->leasestart[lease], lease_counters);
+      }
+    }
+    // the leases of a kernel are held until it has completed
+    tshasherctx->dispenser.release(dev_ctx->leaseholder);
+    dev_ctx->lastschedulediterations_total = claimed * chunk_counters;
+
+    if (claimed == 0 && !tshasherctx->aborted) {
+      // the kernel has not seen its leases, which must not happen, so the device
+      // continues with the kernels that get their ranges as arguments
+      std::cout << "The persistent kernel of " << dev_ctx->device_name << " has not hashed any counters, "
+        << "it launches a kernel per range instead." << std::endl;
+      run_kernel_loop(dev_ctx);
+      return;
+    }
+
+    slot->audited = false;
+    readResults(dev_ctx, group, CL_TRUE);
+    read_kernel_result(dev_ctx, slot, claimed * chunk_counters);
+    releaseResults(dev_ctx, group);
+    if (slot->droppedhits > 0) {
+      // the best counter may be among the dropped hits, so the claimed chunks of every lease are hashed again
+      for (cl_uint lease = 0; lease < queue->published && lease * lease_chunks < claimed; lease++) {
+        const uint64_t leaseclaimed = std::min((uint64_t)lease_chunks, (uint64_t)claimed - lease * lease_chunks);
+        updateBest(dev_ctx, hashOnHost(dev_ctx->identitystring, queue->leasestart[lease], leaseclaimed * chunk_counters));
+      }
+    }
+  }
+}
+
+void TSHasherContext::launchBatch(DeviceContext* dev_ctx, LaunchSlot* slot, cl::Kernel kernel,
+  const cl::Buffer& d_batch, const std::vector<BatchEntry>& entries, size_t global_work_size) {
+  cl_int err = dev_ctx->command_queue.enqueueWriteBuffer(d_batch, CL_TRUE, 0, entries.size() * sizeof(BatchEntry), entries.data());
+  err |= kernel.setArg(0, (cl_uint)entries.size());
+  err |= kernel.setArg(1, d_batch);
+  err |= kernel.setArg(2, dev_ctx->d_identitystate);
+  err |= kernel.setArg(3, slot->d_hitcount);
+  err |= kernel.setArg(4, slot->d_hits);
+  err |= kernel.setArg(5, dev_ctx->d_abortword);
+  err |= kernel.setArg(6, slot->d_progress);
+  err |= kernel.setArg(7, slot->d_histogram);
+  err |= kernel.setArg(8, slot->d_checksums);
+
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while " << "setting kernel arguments." << std::endl;
+    exit(-1);
+  }
+
+  err = dev_ctx->command_queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+    cl::NDRange(global_work_size),
+    cl::NDRange(dev_ctx->local_work_size),
+    NULL);
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while enqueuing the kernel." << std::endl;
+    exit(-1);
+  }
+  dev_ctx->command_queue.flush();
+}
+
+void TSHasherContext::checkBatchKernel(DeviceContext* dev_ctx) {
+  // a single work group of an identity without any items runs through the batch path once,
+  // such that a broken setup fails right away instead of in the middle of the computation
+  LaunchGroup* group = &dev_ctx->groups[0];
+  LaunchSlot* slot = &group->launches[0];
+  group->launched = 1;
+  slot->audited = false;
+  const uint64_t startcounter = dev_ctx->tshasherctx->dispenser.next();
+  cl::Buffer d_batch(dev_ctx->context, CL_MEM_READ_ONLY, sizeof(BatchEntry));
+  const std::vector<BatchEntry> entries = { { startcounter, 0, 0, 0, 0, 0, 0 } };
+  launchBatch(dev_ctx, slot, dev_ctx->kernelgenerator.getBatchKernel(TSUtil::decimalLength(startcounter)),
+    d_batch, entries, dev_ctx->local_work_size);
+  if (dev_ctx->command_queue.finish() != CL_SUCCESS) {
+    std::cout << "A critical error occurred while checking the batch kernel." << std::endl;
+    exit(-1);
+  }
+  readResults(dev_ctx, group, CL_TRUE);
+  const cl_uint hitcount = *slot->h_hitcount;
+  releaseResults(dev_ctx, group);
+  if (hitcount != 0) {
+    std::cout << "A critical error occurred while checking the batch kernel." << std::endl;
+    exit(-1);
+  }
+}
 
+void TSHasherContext::run_batch_loop(DeviceContext* dev_ctx) {
+  TSHasherContext* tshasherctx = dev_ctx->tshasherctx;
+  std::vector<BatchIdentity>& batch = tshasherctx->batch;
+  LaunchGroup* group = &dev_ctx->groups[0];
+  LaunchSlot* slot = &group->launches[0];
+  group->launched = 1;
+  const uint64_t counters_per_item = dev_ctx->getCountersPerItem();
+  const size_t local_work_size = dev_ctx->local_work_size;
+  const size_t groups = dev_ctx->global_work_size / local_work_size;
+  // every identity of a launch gets at least one work group
+  const size_t max_members = std::min((size_t)BatchEntry::MAX_IDENTITIES, groups);
+
+  cl::Buffer d_batch(dev_ctx->context, CL_MEM_READ_ONLY, BatchEntry::MAX_IDENTITIES * sizeof(BatchEntry));
+  std::vector<BatchEntry> entries;
+  // the identities of the current launch, together with the counters
+  // after their kernel ranges that do not fill a work item
+  std::vector<size_t> members;
+  std::vector<uint64_t> memberstarts;
+  std::vector<uint64_t> hoststarts;
+  std::vector<uint64_t> hostcounters;
+
+  // an identity is further behind than another one if its scheduled counters
+  // are a smaller multiple of its weight
+  auto behind = [&batch](size_t a, size_t b) -> bool {
+    return (double)batch[a].scheduledcounters / batch[a].weight < (double)batch[b].scheduledcounters / batch[b].weight;
+  };
+
+  while (tshasherctx->timerkiller.running()) {
+    // the identity that is furthest behind determines the counter length of the launch,
+    // all identities with the same counter length take part in it
+    uint8_t counterlength;
+    {
+      std::lock_guard<std::mutex> lock(tshasherctx->startcounter_mutex);
+      size_t lead = 0;
+      for (size_t i = 1; i < batch.size(); i++) {
+        if (behind(i, lead)) { lead = i; }
+      }
+      counterlength = TSUtil::decimalLength(batch[lead].startcounter);
+    }
+    // the kernel is looked up without the lock, since this may have to wait for its build
+    cl::Kernel kernel = dev_ctx->kernelgenerator.getBatchKernel(counterlength);
 
-    // this is a workaround to reduce the cpu load for implementations (as NVIDIA's) doing busy waiting
-    #ifdef BUSYWAITING_WORKAROUND
-    err = dev_ctx->command_queue.flush();
-    if (dev_ctx->devicetype != CL_DEVICE_TYPE_CPU && dev_ctx->tshasherctx->throttlefactor == 1) {
-      // no throttling: we aim for maximum performance
-      // we sleep for the recent minimal time (slightly damped) needed to execute the kernel
-      // this reduces cpu load significantly
-      std::this_thread::sleep_for(dev_ctx->getRecentMinTime() * 0.9);
+    tshasherctx->startcounter_mutex.lock();
+    members.clear();
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (TSUtil::decimalLength(batch[i].startcounter) == counterlength) { members.push_back(i); }
+    }
+    if (members.empty()) {
+      // the identities of this length have reached the next one in the meantime
+      tshasherctx->startcounter_mutex.unlock();
+      continue;
+    }
+    std::sort(members.begin(), members.end(), behind);
+    if (members.size() > max_members) { members.resize(max_members); }
+
+    // at most BatchEntry::MAX_IDENTITIES weights of at most IdentityProgress::MAX_WEIGHT are summed up
+    uint64_t weights = 0;
+    for (size_t index : members) { weights += batch[index].weight; }
+    // all work items run the same iterations, so the launch takes as long as one of the grid
+    const uint64_t launchiterations = dev_ctx->adaptLaunchIterations(tshasherctx->options.kerneltime / 1e3, MAX_LAUNCH_ITERATIONS);
+
+    // the work groups are split by the weights, the identities that are furthest behind come first
+    // and the last one gets the groups that are left over
+    entries.clear();
+    memberstarts.clear();
+    hoststarts.clear();
+    hostcounters.clear();
+    uint64_t scheduledcounters = 0;
+    size_t firstgroup = 0;
+    for (size_t k = 0; k < members.size(); k++) {
+      BatchIdentity& member = batch[members[k]];
+      const size_t groups_left = groups - firstgroup - (members.size() - k - 1);
+      const size_t membergroups = (k + 1 == members.size()) ? groups_left
+        : std::min(groups_left, std::max((size_t)1, (size_t)((double)groups * member.weight / weights)));
+
+      // the ranges of the work items have to start at a multiple of the digit batch
+      const uint64_t memberstart = member.startcounter - member.startcounter % dev_ctx->digit_batch;
+      const uint64_t its_constant_length = TSUtil::itsConstantCounterLength(memberstart);
+      uint64_t items = membergroups * local_work_size;
+      uint64_t iterations = std::min(launchiterations, its_constant_length / (items * counters_per_item));
+      uint64_t membercounters_host = 0;
+      if (iterations == 0) {
+        // too few counters remain until the counter length increases for a single iteration
+        // of the groups, so fewer work items hash one iteration each (see launchRange)
+        iterations = 1;
+        items = its_constant_length / counters_per_item;
+        membercounters_host = its_constant_length % counters_per_item;
+      }
+      const uint64_t membercounters_kernel = items * iterations * counters_per_item;
+
+      if (items > 0) {
+        const uint8_t targetdifficulty = std::max(tshasherctx->MIN_TARGET_DIFFICULTY, (uint8_t)(1 + member.bestdifficulty));
+        BatchEntry entry = { memberstart, (cl_uint)firstgroup, (cl_uint)items, (cl_uint)iterations,
+          targetdifficulty, (cl_uint)members[k], 0 };
+        entries.push_back(entry);
+        firstgroup += (size_t)((items + local_work_size - 1) / local_work_size);
+      }
+      hoststarts.push_back(memberstart + membercounters_kernel);
+      hostcounters.push_back(membercounters_host);
+      // the range is in flight until its results have been evaluated
+      memberstarts.push_back(memberstart);
+      member.inflight.insert(memberstart);
+
+      member.startcounter = memberstart + membercounters_kernel + membercounters_host;
+      member.scheduledcounters += membercounters_kernel + membercounters_host;
+      scheduledcounters += membercounters_kernel + membercounters_host;
     }
-    else if (dev_ctx->devicetype != CL_DEVICE_TYPE_CPU) {
-      // throttling: we aim for reduced cpu load
-      std::this_thread::sleep_for(dev_ctx->getRecentMinTime() * 0.94);
+    const size_t global_work_size = firstgroup * local_work_size;
+    if (global_work_size > 0) {
+      dev_ctx->measureTime();
+      dev_ctx->lastscheduled_startcounter = entries[0].startcounter;
+      dev_ctx->schedulediterations_total += scheduledcounters;
+      dev_ctx->lastschedulediterations_total = scheduledcounters;
     }
-    #endif
+    tshasherctx->startcounter_mutex.unlock();
 
+    if (global_work_size > 0) {
+      launchBatch(dev_ctx, slot, kernel, d_batch, entries, global_work_size);
+    }
+
+    // the host hashes its counters while the kernel is running
+    uint64_t hashed_host = 0;
+    for (size_t k = 0; k < members.size(); k++) {
+      if (hostcounters[k] == 0) { continue; }
+      updateBatchBest(tshasherctx, members[k], hashOnHost(batch[members[k]].identity, hoststarts[k], hostcounters[k]));
+      hashed_host += hostcounters[k];
+    }
+    // the ranges of the launch are finished, once their results have been evaluated
+    auto finishMembers = [tshasherctx, &batch, &members, &memberstarts]() -> void {
+      std::lock_guard<std::mutex> lock(tshasherctx->startcounter_mutex);
+      for (size_t k = 0; k < members.size(); k++) {
+        std::multiset<uint64_t>& inflight = batch[members[k]].inflight;
+        inflight.erase(inflight.find(memberstarts[k]));
+      }
+    };
+    if (global_work_size == 0) {
+      dev_ctx->completediterations_total += hashed_host;
+      finishMembers();
+      continue;
+    }
+    // as well as the checksum of an audited work item of a random identity
+    slot->audited = isAuditDue(dev_ctx);
+    const BatchEntry& auditentry = entries[dev_ctx->auditrng() % entries.size()];
+    const size_t audititem = slot->audited ? dev_ctx->auditrng() % auditentry.items : 0;
+    const uint32_t auditchecksum = !slot->audited ? 0 : getItemChecksum(dev_ctx, batch[auditentry.identity].identity,
+      auditentry.startcounter, audititem, auditentry.items, auditentry.iterations);
+    slot->audititem = auditentry.firstgroup * local_work_size + audititem;
     dev_ctx->command_queue.finish();
+    readResults(dev_ctx, group, CL_TRUE);
+    if (slot->audited && !dev_ctx->tshasherctx->aborted) {
+      verifyChecksum(dev_ctx, *slot->h_checksum, auditchecksum);
+    }
 
-    if (!dev_ctx->tshasherctx->timerkiller.running()) {
+    if (dev_ctx->tshasherctx->aborted) {
+      // the kernel has been stopped, we make sure that the counters
+      // every identity has not reached are hashed again after a restart
+      // (if we cannot tell how far the kernel got, they are hashed again entirely)
+      const bool progressread = readProgress(dev_ctx, slot, global_work_size);
+      uint64_t hashed = 0;
+      std::lock_guard<std::mutex> lock(tshasherctx->startcounter_mutex);
+      for (const BatchEntry& entry : entries) {
+        uint64_t firstunhashed = entry.startcounter;
+        if (progressread) {
+          firstunhashed = getFirstUnhashedCounter(dev_ctx, slot, entry.startcounter,
+            entry.firstgroup * local_work_size, entry.items, entry.iterations, &hashed);
+        }
+        BatchIdentity& member = batch[entry.identity];
+        member.startcounter = std::min((uint64_t)member.startcounter, firstunhashed);
+      }
+      dev_ctx->lastschedulediterations_total = hashed;
+    }
+    read_kernel_result(dev_ctx, slot, dev_ctx->lastschedulediterations_total);
+    releaseResults(dev_ctx, group);
+    if (slot->droppedhits > 0) {
+      // the best counter of any identity may be among the dropped hits, so all entries are hashed again
+      for (const BatchEntry& entry : entries) {
+        updateBatchBest(tshasherctx, entry.identity, hashOnHost(batch[entry.identity].identity, entry.startcounter,
+          (uint64_t)entry.items * entry.iterations * counters_per_item));
+      }
+    }
+    finishMembers();
+  }
+}
+
+// the 32bit big endian word t of the message
+static uint32_t getMessageWord(const uint8_t* message, size_t t) {
+  return ((uint32_t)message[4 * t] << 24) | ((uint32_t)message[4 * t + 1] << 16)
+    | ((uint32_t)message[4 * t + 2] << 8) | (uint32_t)message[4 * t + 3];
+}
+
+// increments the decimal ASCII number in place, an overflow wraps around to zero
+static void incrementDecimal(uint8_t* digits, size_t length) {
+  for (size_t i = length; i > 0; i--) {
+    if (digits[i - 1] != '9') {
+      digits[i - 1]++;
       return;
     }
-    const size_t size_results = dev_ctx->global_work_size * sizeof(uint8_t);
-    err = dev_ctx->command_queue.enqueueReadBuffer(dev_ctx->d_results, CL_TRUE, 0, size_results, dev_ctx->h_results);
-    read_kernel_result(dev_ctx);
+    digits[i - 1] = '0';
   }
 }
 
-void TSHasherContext::read_kernel_result(DeviceContext* dev_ctx) {
+// hashes the range of counters with the native engine, which starts from the given midstate
+// and the rest of the public key after it, and calls visit(counter, digests, active) for every
+// batch of active lanes starting at counter, word j of the digest of lane l is digests[j*lanes + l]
+// the range must not cross an increase of the counter length
+template<typename Visitor>
+static void hashNative(const Sha1LanesBackend& backend, const uint32_t midstate[5],
+  const std::string& identitytail, size_t identitylength,
+  uint64_t rangestart, uint64_t rangecounters, Visitor visit) {
+  const size_t lanes = backend.lanes;
+  const size_t taillength = identitytail.size();
+
+  // the rest of the public key is shorter than a block and the counter has at most
+  // 20 digits, so at most two blocks follow the midstate
+  uint8_t message[128];
+  std::vector<uint32_t> words(2 * 16 * lanes);
+  std::vector<uint32_t> digests(5 * lanes);
+
+  // the message after the midstate consists of the rest of the public key,
+  // the counter, the padding byte and the message length in bits
+  const std::string counterstring = std::to_string(rangestart);
+  const size_t counterlength = counterstring.size();
+  const size_t messagelength = taillength + counterlength;
+  const size_t blocks = (messagelength + 1 + 8 + 63) / 64;
+  const uint64_t bitlength = 8 * (uint64_t)(identitylength + counterlength);
+  std::fill(message, message + sizeof(message), 0);
+  std::copy(identitytail.begin(), identitytail.end(), message);
+  std::copy(counterstring.begin(), counterstring.end(), message + taillength);
+  message[messagelength] = 0x80;
+  for (size_t i = 0; i < 8; i++) {
+    message[64 * blocks - 1 - i] = (uint8_t)(bitlength >> (8 * i));
+  }
 
-  dev_ctx->completediterations_total += dev_ctx->lastschedulediterations_total;
-  dev_ctx->completed_kernels++;
+  // only the words holding the counter differ between the lanes
+  for (size_t t = 0; t < 16 * blocks; t++) {
+    std::fill(words.begin() + t * lanes, words.begin() + (t + 1) * lanes, getMessageWord(message, t));
+  }
+  const size_t firstword = taillength / 4;
+  const size_t lastword = (messagelength - 1) / 4;
+
+  for (uint64_t batch = 0; batch < rangecounters; batch += lanes) {
+    const size_t active = (size_t)std::min((uint64_t)lanes, rangecounters - batch);
+    for (size_t l = 0; l < active; l++) {
+      for (size_t t = firstword; t <= lastword; t++) {
+        words[t * lanes + l] = getMessageWord(message, t);
+      }
+      incrementDecimal(message + taillength, counterlength);
+    }
+    backend.compress(midstate, words.data(), blocks, digests.data());
+    visit(rangestart + batch, digests.data(), active);
+  }
+}
 
-  // read the result
-  uint8_t oldbestdifficulty = dev_ctx->bestdifficulty;
-  for (uint32_t thread = 0; thread < dev_ctx->global_work_size; thread++) {
-    if (dev_ctx->h_results[thread]) {
-      // target found: now we search for the correct counter
-      uint64_t its_per_worker = dev_ctx->lastschedulediterations_total / dev_ctx->global_work_size;
-      uint64_t searchstartcounter = dev_ctx->lastscheduled_startcounter + its_per_worker * thread;
-      uint8_t bestdifficulty = 0;
-      uint64_t bestdifficulty_counter = 0;
-
-      for (uint64_t counter = searchstartcounter;
-        counter < searchstartcounter + its_per_worker;
-        counter++) {
-        uint8_t currentdifficulty = TSUtil::getDifficulty(dev_ctx->identitystring, counter);
-        if (currentdifficulty > bestdifficulty) {
-          bestdifficulty = currentdifficulty;
-          bestdifficulty_counter = counter;
+void TSHasherContext::run_cpu_loop(CpuContext* cpu_ctx, unsigned thread_id) {
+  using namespace std::chrono;
+  TSHasherContext* tshasherctx = cpu_ctx->tshasherctx;
+
+  while (tshasherctx->timerkiller.running()) {
+    // the ranges must not cross an increase of the counter length
+    uint64_t rangestart;
+    uint64_t rangecounters;
+    auto count = [](uint64_t available) -> uint64_t {
+      return std::min(CPU_RANGE_COUNTERS, available);
+    };
+    const size_t holder = cpu_ctx->holders[thread_id];
+    if (!tshasherctx->dispenser.take(holder, TSUtil::decimalLength(tshasherctx->dispenser.next()), count, &rangestart, &rangecounters)) {
+      // another thread has reached the next counter length in the meantime
+      continue;
+    }
+    const auto rangebegin = high_resolution_clock::now();
+
+    hashNative(cpu_ctx->backend, cpu_ctx->midstate, cpu_ctx->identitytail, cpu_ctx->identitystring.size(),
+      rangestart, rangecounters, [cpu_ctx](uint64_t counter, const uint32_t* digests, size_t active) -> void {
+      // we only consider security levels 32 or larger, as the kernels do
+      for (size_t l = 0; l < active; l++) {
+        if (digests[l] != 0) { continue; }
+        const uint8_t difficulty = TSUtil::getDifficulty(cpu_ctx->identitystring, counter + l);
+        std::lock_guard<std::mutex> lock(cpu_ctx->bestdifficulty_mutex);
+        if (difficulty > cpu_ctx->bestdifficulty) {
+          cpu_ctx->bestdifficulty = difficulty;
+          cpu_ctx->bestdifficulty_counter = counter + l;
         }
       }
+    });
 
-      if (bestdifficulty > dev_ctx->bestdifficulty) {
-        dev_ctx->bestdifficulty = bestdifficulty;
-        dev_ctx->bestdifficulty_counter = bestdifficulty_counter;
-      }
-      else if (bestdifficulty <= oldbestdifficulty) {
-        // this should never happen
-        std::cout << std::endl << "A critical error occurred." << std::endl;
-        std::cout << "Claimed target could not be found." << std::endl;
-        exit(-1);
-      }
+    const double seconds = duration_cast<nanoseconds>(high_resolution_clock::now() - rangebegin).count() / 1e9;
+    cpu_ctx->recentspeeds[thread_id] = rangecounters / seconds;
+    cpu_ctx->completediterations_total += rangecounters;
+    cpu_ctx->completed_ranges++;
+    tshasherctx->dispenser.release(holder);
+  }
+}
+
+bool TSHasherContext::isAuditDue(DeviceContext* dev_ctx) {
+  TSHasherContext* tshasherctx = dev_ctx->tshasherctx;
+  if (!tshasherctx->options.audit) {
+    return false;
+  }
+  // the audits are skipped as long as they have taken more than their share of the running time
+  const auto runningtime = std::chrono::high_resolution_clock::now() - tshasherctx->starttime;
+  return dev_ctx->audittime_ns <= AUDIT_MAX_SHARE * std::chrono::duration_cast<std::chrono::nanoseconds>(runningtime).count();
+}
+
+uint32_t TSHasherContext::getItemChecksum(DeviceContext* dev_ctx, const std::string& identity,
+  uint64_t rangestart, size_t item, size_t items, uint64_t iterations) {
+  const auto auditbegin = std::chrono::high_resolution_clock::now();
+  // the complete blocks of the public key are the same for every counter
+  const size_t prefixlength = identity.size() - TSUtil::getTailLength(identity.size());
+  SHA1 ctx;
+  ctx.update(identity.substr(0, prefixlength));
+  const std::vector<uint32_t> state = ctx.midstate();
+  uint32_t midstate[5];
+  std::copy(state.begin(), state.end(), midstate);
+  const std::string identitytail = identity.substr(prefixlength);
+
+  const Sha1LanesBackend& backend = dev_ctx->tshasherctx->auditbackend;
+  uint32_t checksum = 0;
+  auto fold = [&checksum, &backend](uint64_t, const uint32_t* digests, size_t active) -> void {
+    for (size_t l = 0; l < active; l++) {
+      for (size_t j = 0; j < 5; j++) { checksum ^= digests[j * backend.lanes + l]; }
+    }
+  };
+
+  // the counters of the work item as in firstCounters in Kernel.h
+  const uint64_t counters_per_item = dev_ctx->getCountersPerItem();
+  if (dev_ctx->tshasherctx->options.layout == LAYOUT_INTERLEAVED) {
+    for (uint64_t it = 0; it < iterations; it++) {
+      hashNative(backend, midstate, identitytail, identity.size(),
+        rangestart + (it * items + item) * counters_per_item, counters_per_item, fold);
+    }
+  }
+  else {
+    hashNative(backend, midstate, identitytail, identity.size(),
+      rangestart + item * iterations * counters_per_item, iterations * counters_per_item, fold);
+  }
+  dev_ctx->audittime_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - auditbegin).count();
+  return checksum;
+}
+
+void TSHasherContext::verifyChecksum(DeviceContext* dev_ctx, cl_uint checksum, uint32_t expected) {
+  dev_ctx->audited_items++;
+  if (checksum != expected) {
+    dev_ctx->failed_audits++;
+  }
+}
+
+void TSHasherContext::readResults(DeviceContext* dev_ctx, LaunchGroup* group, cl_bool blocking) {
+  cl::CommandQueue& queue = dev_ctx->command_queue;
+  cl_int err = CL_SUCCESS;
+  cl_int maperr = CL_SUCCESS;
+
+  // the regions of all launches are mapped at once, the hit counts and the histograms are cleared through the mapping
+  group->h_results = static_cast<uint8_t*>(queue.enqueueMapBuffer(group->d_results, blocking,
+    CL_MAP_READ | CL_MAP_WRITE, 0, group->launched * group->regionsize, NULL, NULL, &maperr));
+  err |= maperr;
+  for (size_t k = 0; k < group->launched; k++) {
+    LaunchSlot* slot = &group->launches[k];
+    uint8_t* region = group->h_results + k * group->regionsize;
+    slot->h_hitcount = reinterpret_cast<cl_uint*>(region);
+    slot->h_histogram = reinterpret_cast<cl_uint*>(region + group->histogramoffset);
+    slot->h_hits = reinterpret_cast<HitRecord*>(region + group->hitsoffset);
+    if (slot->audited) {
+      slot->h_checksum = static_cast<cl_uint*>(queue.enqueueMapBuffer(slot->d_checksums, blocking,
+        CL_MAP_READ, slot->audititem * sizeof(cl_uint), sizeof(cl_uint), NULL, NULL, &maperr));
+      err |= maperr;
+    }
+  }
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while reading the kernel results." << std::endl;
+    exit(-1);
+  }
+}
+
+void TSHasherContext::releaseResults(DeviceContext* dev_ctx, LaunchGroup* group) {
+  cl::CommandQueue& queue = dev_ctx->command_queue;
+  // the unmaps are queued in front of the next launches of the group, so we need not wait for them
+  cl_int err = CL_SUCCESS;
+  for (size_t k = 0; k < group->launched; k++) {
+    LaunchSlot* slot = &group->launches[k];
+    *slot->h_hitcount = 0;
+    if (dev_ctx->tshasherctx->options.histogram) {
+      std::fill(slot->h_histogram, slot->h_histogram + 2 * DifficultyHistogram::BINS, 0);
+    }
+    if (slot->audited) {
+      err |= queue.enqueueUnmapMemObject(slot->d_checksums, slot->h_checksum);
+    }
+  }
+  err |= queue.enqueueUnmapMemObject(group->d_results, group->h_results);
+  err |= queue.flush();
+  if (err != CL_SUCCESS) {
+    std::cout << "A critical error occurred while reading the kernel results." << std::endl;
+    exit(-1);
+  }
+}
+
+void TSHasherContext::read_kernel_result(DeviceContext* dev_ctx, LaunchSlot* slot, uint64_t completedcounters) {
+
+  dev_ctx->completediterations_total += completedcounters;
+  dev_ctx->completed_kernels++;
+  // the histogram covers the same kernels as the completed counters
+  if (dev_ctx->tshasherctx->options.histogram) {
+    for (cl_uint b = 0; b < DifficultyHistogram::BINS; b++) {
+      dev_ctx->histogram.bins[b] += slot->h_histogram[2 * b] + ((uint64_t)slot->h_histogram[2 * b + 1] << 32);
+    }
+  }
+
+  slot->droppedhits = *slot->h_hitcount > MAX_HITS ? *slot->h_hitcount - MAX_HITS : 0;
+  if (slot->droppedhits > 0) {
+    std::cout << std::endl << "Warning: " << slot->droppedhits
+      << " hits have been dropped by the kernel, its range is hashed again on the host." << std::endl;
+  }
+
+  // read the result
+  // the kernel reports the counters reaching the target, we only verify these
+  // the hits of the batch kernel belong to the identity they are tagged with
+  TSHasherContext* tshasherctx = dev_ctx->tshasherctx;
+  const bool batched = tshasherctx->options.batch;
+  const cl_uint num_hits = std::min(*slot->h_hitcount, MAX_HITS);
+  for (cl_uint i = 0; i < num_hits; i++) {
+    const HitRecord& hit = slot->h_hits[i];
+    const bool valid_identity = !batched || hit.identity < tshasherctx->batch.size();
+    const uint8_t difficulty = !valid_identity ? 0 : TSUtil::getDifficulty(
+      batched ? tshasherctx->batch[hit.identity].identity : dev_ctx->identitystring, hit.counter);
+    if (!valid_identity || difficulty != hit.difficulty) {
+      // this should never happen
+      std::cout << std::endl << "A critical error occurred." << std::endl;
+      std::cout << "Claimed target could not be verified." << std::endl;
+      exit(-1);
+    }
+
+    if (batched) {
+      updateBatchBest(tshasherctx, hit.identity, std::make_pair(difficulty, (uint64_t)hit.counter));
+    }
+    else {
+      updateBest(dev_ctx, std::make_pair(difficulty, (uint64_t)hit.counter));
     }
   }
 }
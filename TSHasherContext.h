@@ -22,12 +22,22 @@ SOFTWARE.
 #ifndef TSHASHERCONTEXT_H_
 #define TSHASHERCONTEXT_H_
 
+#include "BatchIdentity.h"
+#include "ComputeOptions.h"
+#include "CpuContext.h"
 #include "DeviceContext.h"
+#include "RangeDispenser.h"
+#include "Sha1Lanes.h"
+#include "Table.h"
 #include "TimerKiller.h"
 #include "TSUtil.h"
+#include "TunedParameters.h"
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -43,52 +53,108 @@ SOFTWARE.
 #define __stdcall
 #endif
 
-#define DEV_TYPE    CL_DEVICE_TYPE_GPU
-// #define DEV_TYPE      CL_DEVICE_TYPE_CPU | CL_DEVICE_TYPE_GPU
-// #define DEV_TYPE      CL_DEVICE_TYPE_CPU
-
 // forward declaration because of cyclic dependency
 // between DeviceContext and TSHasherContext
 class DeviceContext;
+class CpuContext;
+struct LaunchSlot;
+struct LaunchGroup;
+struct BatchEntry;
 
 class TSHasherContext {
 public:
   TSHasherContext(std::string identity,
     uint64_t startcounter,
     uint64_t bestcounter,
-    uint64_t throttlefactor);
+    uint64_t throttlefactor,
+    ComputeOptions options);
+  // computes all given identities at once with the batch kernel,
+  // they need public keys of the same length
+  TSHasherContext(std::vector<BatchIdentity> identities,
+    uint64_t throttlefactor,
+    ComputeOptions options);
 
   void compute();
-  void printinfo(const std::vector<DeviceContext>& dev_ctxs);
+  void printinfo(const std::deque<DeviceContext>& dev_ctxs);
   static void run_kernel_loop(DeviceContext* dev_ctx);
+  static void run_persistent_loop(DeviceContext* dev_ctx);
+  static void run_batch_loop(DeviceContext* dev_ctx);
+  static void run_cpu_loop(CpuContext* cpu_ctx, unsigned thread_id);
 
   TimerKiller timerkiller;
+  // set before the abort word of the devices is written, once it is set,
+  // the results of a kernel may stem from an aborted kernel
+  std::atomic<bool> aborted;
 
-  volatile uint64_t startcounter;
+  // the counters of the identity, only used without the batch kernel
+  RangeDispenser dispenser;
   volatile uint8_t global_bestdifficulty;
   volatile uint64_t global_bestdifficulty_counter;
+  // the identities of the batch, only used with the batch kernel
+  std::vector<BatchIdentity> batch;
+  // the first counter of the identity of the batch that may not have been hashed yet
+  // and the counter of its best difficulty, with which its progress is saved
+  std::pair<uint64_t, uint64_t> getBatchProgress(size_t index);
 
 private:
-  std::pair<uint64_t, uint64_t> tune(cl::Device* device, cl_uint device_id, const char* build_opts);
+  void setupDevices();
+  TunedParameters tune(cl::Device* device, cl_uint device_id, uint32_t vendor_id, const char* build_opts,
+    cl_uint native_vector_size, cl_uint max_vector_size);
 
   std::string identity;
 
   uint64_t throttlefactor;
+  ComputeOptions options;
   std::mutex startcounter_mutex;
-  std::vector<DeviceContext> dev_ctxs;
+  // a deque, since the contexts can neither be copied nor moved
+  std::deque<DeviceContext> dev_ctxs;
   std::vector<cl::Device> devices;
+  // the native CPU engine, if it is enabled
+  std::unique_ptr<CpuContext> cpu_ctx;
+  // recomputes the checksums of the audited work items
+  Sha1LanesBackend auditbackend;
   std::chrono::time_point<std::chrono::high_resolution_clock> starttime;
 
-  static void read_kernel_result(DeviceContext* dev_ctx);
+  // enqueues the next range of counters of the device into the slot,
+  // returns false if there is no range of the given counter length left
+  static bool launchRange(DeviceContext* dev_ctx, LaunchSlot* slot, cl::Kernel kernel, uint8_t counterlength);
+  // evaluates the results of the range launched into the slot once its group has been read
+  static void finishRange(DeviceContext* dev_ctx, LaunchSlot* slot);
+  // waits for the results of all launches of the group and evaluates them
+  static void finishGroup(DeviceContext* dev_ctx, LaunchGroup* group);
+  // writes the entries of a batch launch and enqueues the batch kernel for them
+  static void launchBatch(DeviceContext* dev_ctx, LaunchSlot* slot, cl::Kernel kernel,
+    const cl::Buffer& d_batch, const std::vector<BatchEntry>& entries, size_t global_work_size);
+  // runs the batch kernel once without any counters to check the setup of the device
+  static void checkBatchKernel(DeviceContext* dev_ctx);
+  static std::pair<uint8_t, uint64_t> hashOnHost(const std::string& identity, uint64_t rangestart, uint64_t rangecounters);
+  static void updateBest(DeviceContext* dev_ctx, std::pair<uint8_t, uint64_t> best);
+  static void updateBatchBest(TSHasherContext* tshasherctx, size_t index, std::pair<uint8_t, uint64_t> best);
+  static void read_kernel_result(DeviceContext* dev_ctx, LaunchSlot* slot, uint64_t completedcounters);
+  // maps the results of the launches of the group and the checksums of their audited work items
+  static void readResults(DeviceContext* dev_ctx, LaunchGroup* group, cl_bool blocking);
+  // clears the hits and the histograms of the group for its next launches and unmaps them
+  static void releaseResults(DeviceContext* dev_ctx, LaunchGroup* group);
+  // whether the next launch of the device is audited
+  static bool isAuditDue(DeviceContext* dev_ctx);
+  // recomputes the checksum of all digests of work item item out of items,
+  // which share the range of counters starting at rangestart, with the native engine
+  static uint32_t getItemChecksum(DeviceContext* dev_ctx, const std::string& identity,
+    uint64_t rangestart, size_t item, size_t items, uint64_t iterations);
+  // compares the checksum the kernel has written for the audited work item with the recomputed one
+  static void verifyChecksum(DeviceContext* dev_ctx, cl_uint checksum, uint32_t expected);
+  static bool readProgress(DeviceContext* dev_ctx, LaunchSlot* slot, size_t global_work_size);
+  static uint64_t getFirstUnhashedCounter(DeviceContext* dev_ctx, const LaunchSlot* slot, uint64_t rangestart,
+    size_t firstitem, size_t items, uint64_t iterations, uint64_t* hashed);
+  static bool publishLease(DeviceContext* dev_ctx, uint8_t counterlength, uint64_t lease_counters);
   static void clearConsole();
   std::string getFormattedDouble(double x);
   std::string getFormattedDuration(double seconds);
+  Table getBatchTable();
 
   std::string getDeviceIdentifier(cl::Device* device, cl_uint device_id);
 
   static const char* KERNEL_CODE;
-  static const char* KERNEL_NAME;
-  static const char* KERNEL_NAME2;
   static const char* BUILD_OPTS_BASE;
 
   static const size_t MAX_DEVICES;
@@ -97,6 +163,22 @@ private:
   static const uint64_t MAX_GLOBALLOCAL_RATIO;
 
   static const size_t KERNEL_STD_ITERATIONS;
+  static const uint64_t MAX_LAUNCH_ITERATIONS;
+  static const cl_uint MAX_VECTOR_SIZE;
+  static const cl_uint MAX_CPU_VECTOR_SIZE;
+  static const cl_uint MAX_CHAINS;
+  static const cl_uint MAX_ITERATION_UNROLL;
+  static const std::vector<const char*> VARIANT_BUILD_FLAGS;
+  static const cl_uint DIGIT_BATCH;
+  static const cl_uint MAX_HITS;
+  static const cl_uint IN_FLIGHT_LAUNCHES;
+  static const cl_uint MAX_COALESCED_LAUNCHES;
+  static const cl_uint ABORT_POLL_ITERATIONS;
+  static const cl_uint PERSISTENT_GROUPS_PER_COMPUTE_UNIT;
+  static const cl_uint PERSISTENT_CHUNK_ITERATIONS;
+  static const cl_uint PERSISTENT_LAUNCH_LEASES;
+  static const uint64_t CPU_RANGE_COUNTERS;
+  static const double AUDIT_MAX_SHARE;
 
   uint8_t MIN_TARGET_DIFFICULTY;
 };
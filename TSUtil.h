@@ -32,12 +32,32 @@ SOFTWARE.
 class TSUtil {
 public:
   static bool isSlowPhase(size_t identity_length, uint64_t counter) {
-    return identity_length + TSUtil::decimalLength(counter) + 1 + 8 > 128;
+    return isSlowPhaseLength(identity_length, TSUtil::decimalLength(counter));
+  }
+
+  // the complete blocks of the public key are compressed only once, so the counter,
+  // the padding byte and the message length have to fit into the block after them
+  static bool isSlowPhaseLength(size_t identity_length, uint8_t counterlength) {
+    return getTailLength(identity_length) + counterlength + 1 + 8 > 64;
+  }
+
+  // whether the counter does not even fit into the block after the complete blocks
+  static bool countersSpill(size_t identity_length, uint8_t counterlength) {
+    return getTailLength(identity_length) + counterlength > 64;
+  }
+
+  // the number of bytes of the public key after its complete blocks
+  static size_t getTailLength(size_t identity_length) {
+    return identity_length % 64;
   }
 
   static uint64_t itsUntilSlowPhase(size_t identity_length, uint64_t counter) {
     if (isSlowPhase(identity_length, counter)) { return 0; }
-    uint64_t requiredCounterLength = (128 - 8 - 1 - identity_length) + 1;
+    const uint64_t requiredCounterLength = (64 - 8 - 1 - getTailLength(identity_length)) + 1;
+    if (requiredCounterLength > 20) {
+      // no counter is long enough
+      return UINT64_MAX;
+    }
     return powlong(10, requiredCounterLength - 1) - counter;
   }
 
@@ -21,6 +21,7 @@ SOFTWARE.
 */
 #include "TunedParameters.h"
 
+#include <algorithm>
 #include <string>
 
 const char* TunedParameters::DEVICENAME_STR = "devicename";
@@ -28,18 +29,54 @@ const char* TunedParameters::DEVICEIDENTIFIER_STR = "deviceidentifier";
 const char* TunedParameters::TUNEDPARAMETER_STR = "tunedparameter";
 const char* TunedParameters::LOCALWSIZE_STR = "localworksize";
 const char* TunedParameters::GLOBALWSIZE_STR = "globalworksize";
+const char* TunedParameters::VECTORSIZE_STR = "vectorsize";
+const char* TunedParameters::CHAINS_STR = "chains";
+const char* TunedParameters::UNROLL_STR = "unroll";
+const char* TunedParameters::BITSELECT_STR = "bitselect";
+const char* TunedParameters::DECADEDELTAS_STR = "decadedeltas";
+const char* TunedParameters::BUILDFLAGS_STR = "buildflags";
+const char* TunedParameters::COALESCE_STR = "coalesce";
 
-TunedParameters::TunedParameters() {}
+TunedParameters::TunedParameters() : localworksize(0), globalworksize(0), vectorsize(0),
+  chains(0), unroll(0), bitselect(0), decadedeltas(1), coalesce(0) {}
 
 TunedParameters::TunedParameters(std::string devicename,
   std::string deviceidentifier,
   uint64_t localworksize,
-  uint64_t globalworksize) :
+  uint64_t globalworksize,
+  uint64_t vectorsize,
+  uint64_t chains,
+  uint64_t unroll,
+  uint64_t bitselect,
+  uint64_t decadedeltas,
+  std::string buildflags,
+  uint64_t coalesce) :
   devicename(std::move(devicename)),
   deviceidentifier(std::move(deviceidentifier)),
-  localworksize(localworksize), globalworksize(globalworksize)
+  localworksize(localworksize), globalworksize(globalworksize),
+  vectorsize(vectorsize), chains(chains), unroll(unroll), bitselect(bitselect), decadedeltas(decadedeltas),
+  buildflags(std::move(buildflags)),
+  coalesce(coalesce)
 {}
 
+std::string TunedParameters::getBuildOptions() const {
+  return " -D VECT_SIZE=" + std::to_string(vectorsize)
+    + " -D CHAINS=" + std::to_string(chains)
+    + " -D ITERATION_UNROLL=" + std::to_string(unroll)
+    + " -D USE_BITSELECT=" + std::to_string(bitselect)
+    + " -D DECADE_DELTAS=" + std::to_string(decadedeltas)
+    + (buildflags.empty() ? "" : " " + buildflags);
+}
+
+std::string TunedParameters::getVariantDescription() const {
+  return "vector size " + std::to_string(vectorsize)
+    + ", " + std::to_string(chains) + " chain(s)"
+    + ", unroll " + std::to_string(unroll)
+    + (bitselect != 0 ? ", bitselect" : "")
+    + (decadedeltas == 0 ? ", no decade deltas" : "")
+    + (buildflags.empty() ? "" : ", " + buildflags);
+}
+
 std::string TunedParameters::toIniString() const {
   using namespace std;
   ostringstream out;
@@ -48,14 +85,33 @@ std::string TunedParameters::toIniString() const {
   out << string(DEVICEIDENTIFIER_STR) << "=" << deviceidentifier << endl;
   out << string(LOCALWSIZE_STR) << "=" << localworksize << endl;
   out << string(GLOBALWSIZE_STR) << "=" << globalworksize << endl;
+  out << string(VECTORSIZE_STR) << "=" << vectorsize << endl;
+  out << string(CHAINS_STR) << "=" << chains << endl;
+  out << string(UNROLL_STR) << "=" << unroll << endl;
+  out << string(BITSELECT_STR) << "=" << bitselect << endl;
+  out << string(DECADEDELTAS_STR) << "=" << decadedeltas << endl;
+  // the entries are separated by whitespace, so the flags are separated by commas
+  string flags = buildflags;
+  replace(flags.begin(), flags.end(), ' ', ',');
+  out << string(BUILDFLAGS_STR) << "=" << flags << endl;
+  out << string(COALESCE_STR) << "=" << coalesce << endl;
   return out.str();
 }
 
 TunedParameters TunedParameters::parse(const std::string& segment) {
   std::string devicename;
   std::string deviceidentifier;
-  uint64_t localworksize;
-  uint64_t globalworksize;
+  uint64_t localworksize = 0;
+  uint64_t globalworksize = 0;
+  // optional, older configurations do not contain these
+  uint64_t vectorsize = 0;
+  uint64_t chains = 0;
+  uint64_t unroll = 0;
+  uint64_t bitselect = 0;
+  // the decade deltas have been used before they were tuned
+  uint64_t decadedeltas = 1;
+  std::string buildflags;
+  uint64_t coalesce = 0;
 
   bool devicename_set = false;
   bool deviceidentifier_set = false;
@@ -71,6 +127,13 @@ TunedParameters TunedParameters::parse(const std::string& segment) {
       auto prefix_deviceidentifier(string(DEVICEIDENTIFIER_STR) + "=");
       auto prefix_localworksize(string(LOCALWSIZE_STR) + "=");
       auto prefix_globalworksize(string(GLOBALWSIZE_STR) + "=");
+      auto prefix_vectorsize(string(VECTORSIZE_STR) + "=");
+      auto prefix_chains(string(CHAINS_STR) + "=");
+      auto prefix_unroll(string(UNROLL_STR) + "=");
+      auto prefix_bitselect(string(BITSELECT_STR) + "=");
+      auto prefix_decadedeltas(string(DECADEDELTAS_STR) + "=");
+      auto prefix_buildflags(string(BUILDFLAGS_STR) + "=");
+      auto prefix_coalesce(string(COALESCE_STR) + "=");
 
       if (entry.compare(0,
         prefix_devicename.size(),
@@ -100,6 +163,49 @@ TunedParameters TunedParameters::parse(const std::string& segment) {
         globalworksize = stoull(entry.substr(prefix_globalworksize.size()));
         globalworksize_set = true;
       }
+      else if (entry.compare(0,
+        prefix_vectorsize.size(),
+        prefix_vectorsize)
+        == 0) {
+        vectorsize = stoull(entry.substr(prefix_vectorsize.size()));
+      }
+      else if (entry.compare(0,
+        prefix_chains.size(),
+        prefix_chains)
+        == 0) {
+        chains = stoull(entry.substr(prefix_chains.size()));
+      }
+      else if (entry.compare(0,
+        prefix_unroll.size(),
+        prefix_unroll)
+        == 0) {
+        unroll = stoull(entry.substr(prefix_unroll.size()));
+      }
+      else if (entry.compare(0,
+        prefix_bitselect.size(),
+        prefix_bitselect)
+        == 0) {
+        bitselect = stoull(entry.substr(prefix_bitselect.size()));
+      }
+      else if (entry.compare(0,
+        prefix_decadedeltas.size(),
+        prefix_decadedeltas)
+        == 0) {
+        decadedeltas = stoull(entry.substr(prefix_decadedeltas.size()));
+      }
+      else if (entry.compare(0,
+        prefix_buildflags.size(),
+        prefix_buildflags)
+        == 0) {
+        buildflags = entry.substr(prefix_buildflags.size());
+        replace(buildflags.begin(), buildflags.end(), ',', ' ');
+      }
+      else if (entry.compare(0,
+        prefix_coalesce.size(),
+        prefix_coalesce)
+        == 0) {
+        coalesce = stoull(entry.substr(prefix_coalesce.size()));
+      }
       else {
         // we are evaluating this in a strict manner
         // disallowing any unknown entry names
@@ -119,5 +225,12 @@ TunedParameters TunedParameters::parse(const std::string& segment) {
   return TunedParameters(devicename,
     deviceidentifier,
     localworksize,
-    globalworksize);
+    globalworksize,
+    vectorsize,
+    chains,
+    unroll,
+    bitselect,
+    decadedeltas,
+    buildflags,
+    coalesce);
 }
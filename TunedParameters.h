@@ -34,18 +34,54 @@ public:
   std::string deviceidentifier;
   uint64_t localworksize;
   uint64_t globalworksize;
+  // the kernel variant (see Kernel.h)
+  // zero if the parameters stem from a version without vectorized kernels
+  uint64_t vectorsize;
+  // the number of independent SHA1 chains per work item,
+  // zero if the parameters stem from a version without kernel variants
+  uint64_t chains;
+  // the unroll factor of the loop over the iterations
+  uint64_t unroll;
+  // whether the select functions use bitselect
+  uint64_t bitselect;
+  // whether the counters of a decade share the rounds before their last digit (see hashDecade)
+  uint64_t decadedeltas;
+  // additional options passed to the OpenCL compiler
+  std::string buildflags;
+  // the number of launches whose results are read at once,
+  // zero if the parameters stem from a version without coalesced launches
+  uint64_t coalesce;
 
   TunedParameters();
   TunedParameters(std::string devicename,
     std::string deviceidentifier,
     uint64_t localworksize,
-    uint64_t globalworksize);
+    uint64_t globalworksize,
+    uint64_t vectorsize,
+    uint64_t chains,
+    uint64_t unroll,
+    uint64_t bitselect,
+    uint64_t decadedeltas,
+    std::string buildflags,
+    uint64_t coalesce);
+
+  // the build options selecting the kernel variant
+  std::string getBuildOptions() const;
+
+  std::string getVariantDescription() const;
 
   static const char* DEVICENAME_STR;
   static const char* DEVICEIDENTIFIER_STR;
   static const char* TUNEDPARAMETER_STR;
   static const char* LOCALWSIZE_STR;
   static const char* GLOBALWSIZE_STR;
+  static const char* VECTORSIZE_STR;
+  static const char* CHAINS_STR;
+  static const char* UNROLL_STR;
+  static const char* BITSELECT_STR;
+  static const char* DECADEDELTAS_STR;
+  static const char* BUILDFLAGS_STR;
+  static const char* COALESCE_STR;
 
 
   std::string toIniString() const;
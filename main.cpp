@@ -24,6 +24,7 @@ SOFTWARE.
 #include <map>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "Config.h"
 #include "TSHasherContext.h"
@@ -53,9 +54,9 @@ void consoleHandler(int signal) {
 #endif
 
 
-const char* inputarguments_add = "add [-publickey PUBLICKEY] [-startcounter STARTCOUNTER] [-nickname NICKNAME]";
+const char* inputarguments_add = "add [-publickey PUBLICKEY] [-startcounter STARTCOUNTER] [-nickname NICKNAME] [-weight WEIGHT]";
 
-const char* inputarguments_compute = "compute  [-throttle throttlefactor]  [-retune]";
+const char* inputarguments_compute = "compute  [-throttle throttlefactor]  [-retune]  [-layout contiguous|interleaved]  [-persistent]  [-devices gpu|cpu|all]  [-native]  [-nativethreads threads]  [-batch]  [-histogram]  [-audit]  [-kerneltime ms]";
 
 const char* inputarguments_help = "help";
 
@@ -65,8 +66,18 @@ enum StringCode {
   ePUBLICKEY,
   eSTARTCOUNTER,
   eNICKNAME,
+  eWEIGHT,
   eTHROTTLE,
   eRETUNE,
+  eLAYOUT,
+  ePERSISTENT,
+  eDEVICES,
+  eNATIVE,
+  eNATIVETHREADS,
+  eBATCH,
+  eHISTOGRAM,
+  eAUDIT,
+  eKERNELTIME,
   eHELP,
   eERR
 };
@@ -78,9 +89,19 @@ StringCode getStringCode(const std::string& str) {
   if (str == "-publickey") { return ePUBLICKEY; }
   if (str == "-startcounter") { return eSTARTCOUNTER; }
   if (str == "-nickname") { return eNICKNAME; }
+  if (str == "-weight") { return eWEIGHT; }
 
   if (str == "-throttle") { return eTHROTTLE; }
   if (str == "-retune") { return eRETUNE; }
+  if (str == "-layout") { return eLAYOUT; }
+  if (str == "-persistent") { return ePERSISTENT; }
+  if (str == "-devices") { return eDEVICES; }
+  if (str == "-native") { return eNATIVE; }
+  if (str == "-nativethreads") { return eNATIVETHREADS; }
+  if (str == "-batch") { return eBATCH; }
+  if (str == "-histogram") { return eHISTOGRAM; }
+  if (str == "-audit") { return eAUDIT; }
+  if (str == "-kerneltime") { return eKERNELTIME; }
   if (str == "-h" ||
     str == "--h" ||
     str == "-help" ||
@@ -98,6 +119,8 @@ void handleAdd(int argc, char* argv[]) {
   bool publickey_set = false;
   std::string nickname;
   uint64_t startcounter = 0;
+  uint64_t weight = 1;
+  bool weight_set = false;
 
   const std::string inputformat_add = "TeamspeakHasher " + std::string(inputarguments_add) + "\n";
   if (argc < 4) {
@@ -116,8 +139,8 @@ void handleAdd(int argc, char* argv[]) {
     switch (getStringCode(argv[i])) {
     case ePUBLICKEY:
       publickey = std::string(argv[i + 1]);
-      if (publickey.size() < 64 || publickey.size() > 108) {
-        std::cout << "Error: Only public keys of length at least 64 and at most 108 are supported." << std::endl;
+      if (publickey.empty()) {
+        std::cout << "Error: The public key must not be empty." << std::endl;
         exit(-1);
       }
       publickey_set = true;
@@ -132,6 +155,19 @@ void handleAdd(int argc, char* argv[]) {
     case eNICKNAME:
       nickname = std::string(argv[i + 1]);
       break;
+    case eWEIGHT:
+      try {
+        weight = std::stoull(std::string(argv[i + 1]));
+        if (weight == 0 || weight > IdentityProgress::MAX_WEIGHT) {
+          throw std::exception();
+        }
+      }
+      catch (std::exception&) {
+        std::cout << "Error: Invalid weight. The weight needs to be at least 1 and at most " << IdentityProgress::MAX_WEIGHT << "." << std::endl;
+        exit(-1);
+      }
+      weight_set = true;
+      break;
     default:
       std::cout << std::endl << "Error: Invalid arguments. The input format is as follows." << std::endl << inputformat_add;
       exit(-1);
@@ -157,9 +193,12 @@ void handleAdd(int argc, char* argv[]) {
         currentconfig->second.currentcounter = startcounter;
       }
     }
+    if (weight_set) {
+      currentconfig->second.weight = weight;
+    }
   }
   else {
-    Config::conf[publickey] = IdentityProgress(nickname, publickey, startcounter, startcounter);
+    Config::conf[publickey] = IdentityProgress(nickname, publickey, startcounter, startcounter, weight);
   }
 
   bool stored = Config::store();
@@ -171,11 +210,83 @@ void handleAdd(int argc, char* argv[]) {
   }
 }
 
+// computes all identities of the database at once with the batch kernel
+void computeBatch(uint64_t throttlefactor, ComputeOptions options) {
+  if (options.persistent || options.native) {
+    std::cout << "Error: -batch cannot be combined with -persistent, -native or -nativethreads." << std::endl;
+    exit(-1);
+  }
+
+  // the kernel programs are specialized for the length of the public key
+  std::vector<BatchIdentity> batch;
+  for (const auto& entry : Config::conf) {
+    const IdentityProgress& progress = entry.second;
+    if (progress.identity.size() != Config::conf.begin()->second.identity.size()) {
+      std::cout << "Error: -batch requires all public keys in the database to have the same length." << std::endl;
+      exit(-1);
+    }
+    batch.emplace_back(progress.nickname, progress.identity, progress.weight,
+      progress.currentcounter, progress.bestcounter);
+  }
+
+  std::cout << "Initializing OpenCL..." << std::endl;
+
+  TSHasherContext hasherctx(batch, throttlefactor, options);
+
+  hasherctxptr = &hasherctx;
+
+  std::cout << std::endl << std::endl << "Initialization done, starting computation of " << batch.size() << " identities..." << std::endl << std::endl;
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+
+  // the ranges still being hashed must not be skipped after a restart
+  auto saveprogress = [&hasherctx]() -> void {
+    for (size_t i = 0; i < hasherctx.batch.size(); i++) {
+      IdentityProgress& progress = Config::conf[hasherctx.batch[i].identity];
+      const std::pair<uint64_t, uint64_t> batchprogress = hasherctx.getBatchProgress(i);
+      progress.currentcounter = batchprogress.first;
+      progress.bestcounter = batchprogress.second;
+    }
+  };
+
+  // we save our progress every 5 minutes
+  std::thread progress_saver([&hasherctx, &saveprogress]() -> void {
+    while (hasherctx.timerkiller.wait_for(std::chrono::minutes(5))) {
+      saveprogress();
+      Config::store();
+    }
+    });
+
+  #if defined(_WIN32) || defined(_WIN64)
+  if (!SetConsoleCtrlHandler(&consoleHandler, TRUE)) {
+    std::cout << std::endl << "ERROR: Could not set console handler" << std::endl;
+    return;
+  }
+  #else
+  signal(SIGINT, &consoleHandler);
+  #endif
+
+  hasherctx.compute();
+
+  progress_saver.join();
+
+  saveprogress();
+
+  bool stored = Config::store();
+  if (stored) {
+    std::cout << "The progress has been saved successfully." << std::endl;
+  }
+  else {
+    std::cout << "Error: The progress could not be saved." << std::endl;
+  }
+}
+
 void handleCompute(int argc, char* argv[]) {
   bool configavailable = Config::load();
   const auto inputformat_compute = "TeamspeakHasher " + std::string(inputarguments_compute) + "\n";
 
   uint64_t throttlefactor = 1;
+  ComputeOptions options;
 
   if (!configavailable || Config::conf.empty()) {
     std::cout << "Error: Please add a public key first." << std::endl;
@@ -207,6 +318,100 @@ void handleCompute(int argc, char* argv[]) {
       Config::tuned.clear();
       i++;
       break;
+    case eLAYOUT:
+      if (i + 1 >= argc) {
+        std::cout << std::endl << "Error: Too few arguments. The input format is as follows." << std::endl << inputformat_compute;
+        exit(-1);
+      }
+      if (std::string(argv[i + 1]) == "contiguous") {
+        options.layout = LAYOUT_CONTIGUOUS;
+      }
+      else if (std::string(argv[i + 1]) == "interleaved") {
+        options.layout = LAYOUT_INTERLEAVED;
+      }
+      else {
+        std::cout << "Error: Invalid layout. The counter layout must be either contiguous or interleaved." << std::endl;
+        exit(-1);
+      }
+      i += 2;
+      break;
+    case ePERSISTENT:
+      options.persistent = true;
+      i++;
+      break;
+    case eDEVICES:
+      if (i + 1 >= argc) {
+        std::cout << std::endl << "Error: Too few arguments. The input format is as follows." << std::endl << inputformat_compute;
+        exit(-1);
+      }
+      if (std::string(argv[i + 1]) == "gpu") {
+        options.devices = DEVICES_GPU;
+      }
+      else if (std::string(argv[i + 1]) == "cpu") {
+        options.devices = DEVICES_CPU;
+      }
+      else if (std::string(argv[i + 1]) == "all") {
+        options.devices = DEVICES_ALL;
+      }
+      else {
+        std::cout << "Error: Invalid devices. The devices must be either gpu, cpu or all." << std::endl;
+        exit(-1);
+      }
+      i += 2;
+      break;
+    case eNATIVE:
+      options.native = true;
+      i++;
+      break;
+    case eNATIVETHREADS:
+      if (i + 1 >= argc) {
+        std::cout << std::endl << "Error: Too few arguments. The input format is as follows." << std::endl << inputformat_compute;
+        exit(-1);
+      }
+      try {
+        const unsigned long threads = std::stoul(std::string(argv[i + 1]));
+        if (threads == 0 || threads > 4096) {
+          throw std::exception();
+        }
+        options.nativethreads = (unsigned)threads;
+      }
+      catch (std::exception&) {
+        std::cout << "Error: Invalid number of threads. The number of native threads must be at least 1 and at most 4096." << std::endl;
+        exit(-1);
+      }
+      options.native = true;
+      i += 2;
+      break;
+    case eBATCH:
+      options.batch = true;
+      i++;
+      break;
+    case eHISTOGRAM:
+      options.histogram = true;
+      i++;
+      break;
+    case eAUDIT:
+      options.audit = true;
+      i++;
+      break;
+    case eKERNELTIME:
+      if (i + 1 >= argc) {
+        std::cout << std::endl << "Error: Too few arguments. The input format is as follows." << std::endl << inputformat_compute;
+        exit(-1);
+      }
+      try {
+        const unsigned long kerneltime = std::stoul(std::string(argv[i + 1]));
+        if (kerneltime == 0 || kerneltime > 10000) {
+          throw std::exception();
+        }
+        options.kerneltime = (unsigned)kerneltime;
+      }
+      catch (std::exception&) {
+        std::cout << "Error: Invalid kernel time. The kernel time must be at least 1 and at most 10000 milliseconds." << std::endl;
+        exit(-1);
+      }
+      i += 2;
+      break;
     default:
       std::cout << std::endl << "Error: Invalid arguments. The input format is as follows." << std::endl << inputformat_compute;
       exit(-1);
@@ -214,6 +419,16 @@ void handleCompute(int argc, char* argv[]) {
     }
   }
 
+  if (options.audit && options.persistent) {
+    // the persistent kernel claims its chunks dynamically, so the host cannot tell which counters a work item has hashed
+    std::cout << "Error: -audit cannot be combined with -persistent." << std::endl;
+    exit(-1);
+  }
+
+  if (options.batch) {
+    computeBatch(throttlefactor, options);
+    return;
+  }
 
   Config::printidentities();
 
@@ -238,7 +453,7 @@ void handleCompute(int argc, char* argv[]) {
 
   std::cout << "Initializing OpenCL..." << std::endl;
 
-  TSHasherContext hasherctx(publickey, startcounter, bestcounter, throttlefactor);
+  TSHasherContext hasherctx(publickey, startcounter, bestcounter, throttlefactor, options);
 
   hasherctxptr = &hasherctx;
 
@@ -249,7 +464,8 @@ void handleCompute(int argc, char* argv[]) {
   // we save our progress every 5 minutes
   std::thread progress_saver([&selection, &hasherctx]() -> void {
     while (hasherctx.timerkiller.wait_for(std::chrono::minutes(5))) {
-      selection->second.currentcounter = hasherctx.startcounter;
+      // the ranges still being hashed must not be skipped after a restart
+      selection->second.currentcounter = hasherctx.dispenser.firstUnfinished();
       selection->second.bestcounter = hasherctx.global_bestdifficulty_counter;
       Config::store();
     }
@@ -268,7 +484,7 @@ void handleCompute(int argc, char* argv[]) {
 
   progress_saver.join();
 
-  selection->second.currentcounter = hasherctx.startcounter;
+  selection->second.currentcounter = hasherctx.dispenser.firstUnfinished();
   selection->second.bestcounter = hasherctx.global_bestdifficulty_counter;
 
   bool stored = Config::store();
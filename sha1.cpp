@@ -248,6 +248,10 @@ void SHA1::update(std::istream& is) {
   }
 }
 
+std::vector<uint32_t> SHA1::midstate() const {
+  return std::vector<uint32_t>(digest, digest + sizeof(digest) / sizeof(digest[0]));
+}
+
 std::vector<uint8_t> SHA1::final() {
   uint64_t total_bits = (transforms * BLOCK_BYTES + buffer.size()) * 8;
 
@@ -33,6 +33,9 @@ public:
   void update(const std::string& s);
   std::vector<uint8_t> final();
 
+  // returns the internal state after all complete blocks passed so far
+  std::vector<uint32_t> midstate() const;
+
 private:
   void update(std::istream& is);
   void reset();